@@ -7,6 +7,7 @@
 #ifndef DRS_H
 #define DRS_H
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "averager.h"
 
@@ -200,6 +201,21 @@ public:
    virtual ~DRSCallback() {};
 };
 
+/*---- timing calibration waveform, analyzed on a worker thread ----*/
+
+typedef struct {
+   int    iter;
+   int    nIter;
+   bool   slope;                    // AnalyzeSlope() instead of AnalyzePeriod()
+   int    channel;                  // averager channel
+   int    tCell;
+   int    status;
+   float  wf[kNumberOfBins];
+   double *cellDV;
+   double *cellDT;                  // row of fCellDT, set from dt by CommitTiming()
+   double dt[kNumberOfBins];        // copy of cellDT the analysis works on
+} DRSTimingJob;
+
 /*------------------------*/
 
 class DRSBoard;
@@ -406,15 +422,14 @@ protected:
       class FrequencyData {
       public:
          int    fFrequency;
+         long long fModified;    // XML file time and size, validate the cache
+         long long fSize;
          double fBin[kNumberOfBins];
       };
 
-      enum {
-         kMaxNumberOfFrequencies = 4000
-      };
       int            fChip;
       int            fNumberOfFrequencies;
-      FrequencyData *fFrequency[kMaxNumberOfFrequencies];
+      FrequencyData **fFrequency; // sorted by frequency, only those present
 
    private:
       TimeData(const TimeData &c);              // not implemented
@@ -423,14 +438,18 @@ protected:
    public:
       TimeData()
       :fChip(0)
-      ,fNumberOfFrequencies(0) {
+      ,fNumberOfFrequencies(0)
+      ,fFrequency(NULL) {
       }
       ~TimeData() {
          int i;
          for (i = 0; i < fNumberOfFrequencies; i++) {
             delete fFrequency[i];
          }
+         free(fFrequency);
       }
+      FrequencyData *Add(int frequency);
+      void           Remove(int i);
    };
 
 public:
@@ -539,6 +558,10 @@ protected:
    // Fields for Calibration
    int                  fMaxChips;
    char                 fCalibDirectory[1000];
+   unsigned char       *fUsb2Buffer;     // USB2 write command buffer
+   bool                 fLockPending;    // SetFrequencyAsync() not yet locked
+   int                  fLockPolls;
+   int                  fLockResult;
 
    // Fields for Response Calibration old method
    ResponseCalibration *fResponseCalibration;
@@ -671,6 +694,11 @@ public:
    int          SoftTrigger(void);
    int          ReadFrequency(unsigned char chipIndex, double *f);
    int          SetFrequency(double freq, bool wait);
+   // start the change and return, the PLL locks while other work is done
+   int          SetFrequencyAsync(double freq);
+   // 1 = locked, 0 = failed, -1 = still settling
+   int          PollFrequencyLock();
+   int          WaitFrequencyLock();
    double       VoltToFreq(double volt);
    double       FreqToVolt(double freq);
    double       GetNominalFrequency() const { return fNominalFrequency; }
@@ -714,6 +742,8 @@ public:
                            unsigned short *waveform, bool adjustToClock = false);
    bool         IsTimingCalibrationValid(void);
    bool         IsVoltageCalibrationValid(void) { return fVoltageCalibrationValid; }
+   const unsigned short *GetCellOffset(unsigned int chipIndex, unsigned char channel) { return fCellOffset[channel+chipIndex*9]; }
+   const unsigned short *GetCellOffset2(unsigned int chipIndex, unsigned char channel) { return fCellOffset2[channel+chipIndex*9]; }
    int          GetTime(unsigned int chipIndex, int channelIndex, double freq, int tc, float *time, bool tcalibrated=true, bool rotated=true);
    int          GetTime(unsigned int chipIndex, int channelIndex, int tc, float *time, bool tcalibrated=true, bool rotated=true);
    int          GetTimeCalibration(unsigned int chipIndex, int channelIndex, int mode, float *time, bool force=false);
@@ -769,6 +799,7 @@ public:
    int          AnalyzePeriod(Averager *ave, int iIter, int nIter, int channel, float wf[kNumberOfBins], int tCell, double cellDV[kNumberOfBins], double cellDT[kNumberOfBins]);
    int          AnalyzeSlope(Averager *ave, int iIter, int nIter, int channel, float wf[kNumberOfBins], int tCell, double cellDV[kNumberOfBins], double cellDT[kNumberOfBins]);
    int          CalibrateTiming(DRSCallback *pcb);
+   int          CommitTiming(DRSTimingJob *job, int n, int nIterPeriod, int *nError, int *error);
    static void  RemoveSymmetricSpikes(short **wf, int nwf,
                                       short diffThreshold, int spikeWidth,
                                       short maxPeakToPeak, short spikeVoltage,
@@ -777,9 +808,19 @@ protected:
    // Protected Methods
    void         ConstructBoard();
    void         ReadSerialNumber();
+   void         StartFrequencyLock();
    void         ReadCalibration(void);
+   void         ReadCalibrationEEPROM(void);
+   bool         ReadCalibrationCache(const unsigned short *eeprom);
+   void         WriteCalibrationCache(const unsigned short *eeprom);
+   void         GetCalibrationCacheName(char *name, int size);
 
    TimeData    *GetTimeCalibration(unsigned int chipIndex, bool reinit = false);
+   void         ScanTimeCalibration(TimeData *init);
+   bool         ReadTimeCalibrationXML(unsigned int chipIndex, int frequency, double *bin);
+   bool         ReadTimeCalibrationCache(TimeData *init);
+   void         WriteTimeCalibrationCache(TimeData *init);
+   void         GetTimeCalibrationCacheName(unsigned int chipIndex, char *name, int size);
 
    int          GetStretchedTime(float *time, float *measurement, int numberOfMeasurements, float period);
 };
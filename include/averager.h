@@ -13,9 +13,27 @@ class Averager {
    int fNx, fNy, fNz, fDim;
    float *fArray;
    unsigned short *fN;
-   
+   unsigned char *fSorted;     // per cell: 0 = as added, 1 = median selected, 2 = sorted
+
+   // histogram mode, fDim bins from fMin to fMax plus under- and overflow
+   bool fHisto;
+   float fMin, fMax, fBinWidth;
+   unsigned int *fHist;
+
+   Averager(const Averager &c);              // not implemented
+   Averager &operator=(const Averager &rhs); // not implemented
+
+   void Sort(int index);
+   double BinCenter(int bin);
+   double HistoMedian(int index, unsigned int *n);
+
 public:
+   // keep up to dim values per cell, statistics are exact
    Averager(int nx, int ny, int nz, int dim);
+   // streaming mode, every value is counted into one of nBins between min and
+   // max, memory does not grow with the number of values, statistics are
+   // rounded to the bin width
+   Averager(int nx, int ny, int nz, int nBins, float min, float max);
    ~Averager();
    
    void Add(int x, int y, int z, float value);
@@ -0,0 +1,43 @@
+/********************************************************************\
+
+Name:         baseline.h
+
+Contents:     Incremental baseline of one channel, an exponentially
+              weighted mean and variance updated from the pre-trigger
+              samples of every event. Samples beyond clip * sigma of
+              the tracked value (pulses, spikes) are left out. Per cell
+              tracking follows the DRS4 cell behind each sample using
+              the trigger cell.
+
+\********************************************************************/
+
+#pragma once
+
+class BaselineTracker {
+  int fNCells;                  // 0 = whole channel, else cells per chip
+  float fAlpha;                 // weight of a new event
+  float fClip;                  // in sigma
+  float *fMean;
+  float *fVar;
+  bool *fValid;
+  float fChannelMean;
+  float fChannelVar;
+  bool fChannelValid;
+
+  BaselineTracker(const BaselineTracker &c);              // not implemented
+  BaselineTracker &operator=(const BaselineTracker &rhs); // not implemented
+
+public:
+  // nCells 0 tracks the channel only
+  BaselineTracker(float alpha = 0.01, int nCells = 0, float clip = 3);
+  ~BaselineTracker();
+
+  // O(n) in the window wf[first, first + n), cells are (bin + triggerCell) % nCells
+  void Update(const float *wf, int first, int n, int triggerCell);
+
+  bool  IsValid() const { return fChannelValid; }
+  float GetBaseline() const { return fChannelMean; }
+  float GetRms() const;
+  // per cell baseline behind bin, the channel baseline without cells
+  float GetBaseline(int bin, int triggerCell) const;
+};
@@ -0,0 +1,74 @@
+/********************************************************************\
+
+Name:         classifier.h
+
+Contents:     Event classifier policies. Each policy is a struct with a
+              static Classify() on the measured count record, so the
+              event loop is instantiated once per policy and the call
+              is inlined. ClassCounter keeps the totals per class.
+
+\********************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#include "countsLog.h"
+
+// the class numbers CLASS_xxx are defined with the counts records
+// classifiers selectable at startup
+#define CLASSIFIER_AMPLITUDE    0
+#define CLASSIFIER_PSD          1
+#define CLASSIFIER_COINCIDENCE  2
+
+typedef struct {
+  float muonThreshold;          // mV
+  float psdCut;                 // tail / total
+} classifier_config_t;
+
+/*------------------------------------------------------------------*/
+
+// either pad above the threshold is a muon
+struct AmplitudeClassifier {
+  static int Classify(const count_record_t &r, const classifier_config_t &c) {
+    return r.amplitude[0] > c.muonThreshold || r.amplitude[1] > c.muonThreshold ? CLASS_MUON
+                                                                                 : CLASS_NEUTRON;
+  }
+};
+
+// fast pulses are muons, pulses too small for PSD use the amplitude
+struct PsdClassifier {
+  static int Classify(const count_record_t &r, const classifier_config_t &c) {
+    if (r.flags & COUNT_FLAG_PSD)
+      return r.psd < c.psdCut ? CLASS_MUON : CLASS_NEUTRON;
+    return AmplitudeClassifier::Classify(r, c);
+  }
+};
+
+// muons cross several counters, any pair inside its window or, without
+// pairs, two hits in the coincidence window make a muon
+struct CoincidenceClassifier {
+  static int Classify(const count_record_t &r, const classifier_config_t &) {
+    return r.pairMask || r.multiplicity >= 2 ? CLASS_MUON : CLASS_NEUTRON;
+  }
+};
+
+/*------------------------------------------------------------------*/
+
+class ClassCounter {
+  long fCount[N_CLASSES + 1];   // [0] events without class
+
+public:
+  ClassCounter() { memset(fCount, 0, sizeof(fCount)); }
+
+  void Add(int c) { fCount[c + 1]++; }
+  long Get(int c) const { return fCount[c + 1]; }
+
+  void Print(double seconds) const {
+    printf("Totals:");
+    for (int c = 0; c < N_CLASSES; c++)
+      printf(" %ld %s (%.3f/s)", fCount[c + 1], className[c], seconds > 0 ? fCount[c + 1] / seconds : 0);
+    printf(", %ld unclassified\n", fCount[0]);
+  }
+};
@@ -0,0 +1,58 @@
+/********************************************************************\
+
+Name:         coincidence.h
+
+Contents:     Software coincidences across channels and boards. Pulse
+              times of each board are on its rotated time axis, which
+              starts at the trigger cell, so hits of daisy-chained
+              boards share one time base up to a fixed cable offset.
+              Per-pair windows [min, max] absorb that offset.
+
+\********************************************************************/
+
+#pragma once
+
+#define COINC_MAX_BOARDS 4
+#define COINC_MAX_HITS   32       // per board
+#define COINC_MAX_PAIRS  4
+
+typedef struct {
+  float time;                   // ns
+  float amplitude;              // mV
+  unsigned char board;
+  unsigned char channel;
+} hit_t;
+
+typedef struct {
+  int boardA, channelA;
+  int boardB, channelB;
+  float min, max;               // window on time B - time A in ns
+} coinc_pair_t;
+
+class CoincidenceBuilder {
+  float fWindow;
+  int fNPairs;
+  coinc_pair_t fPair[COINC_MAX_PAIRS];
+  int fNHits[COINC_MAX_BOARDS];
+  hit_t fHits[COINC_MAX_BOARDS][COINC_MAX_HITS];
+  int fNMerged;
+  hit_t fMerged[COINC_MAX_BOARDS * COINC_MAX_HITS];
+
+public:
+  CoincidenceBuilder(float window);
+
+  void SetWindow(float window) { fWindow = window; }
+  bool AddPair(const coinc_pair_t &p);
+  int  GetNumberOfPairs() const { return fNPairs; }
+
+  void Clear();
+  // hits of one board may come in any order
+  bool AddHit(int board, int channel, float time, float amplitude);
+
+  // merges the board lists by time, returns the largest number of hits
+  // inside one sliding window; dt[i] of the pairs in the returned
+  // pairMask lie inside their windows
+  int  Build(float *dt, int *pairMask);
+  int  GetNumberOfHits() const { return fNMerged; }
+  const hit_t *GetHits() const { return fMerged; }
+};
@@ -0,0 +1,117 @@
+/********************************************************************\
+
+Name:         columnFile.h
+
+Contents:     Columnar chunked event files. Events are buffered and
+              written in chunks, each holding one header column and one
+              contiguous block per board channel, followed by a footer
+              with column offsets and min/max statistics.
+
+  File    "DRSC" version nBoards nBins range[mV] 0  + "TIME" header
+  Chunk   "CHNK" nEvents nColumns 0 chunkSize(64 bit)
+          header column    int serial[n], long long time_ms[n],
+                           unsigned short triggerCell[nBoards][n]
+          extrema column   unsigned short min[n], max[n]   per channel
+          waveform column  unsigned short adc[n][nBins]    per channel
+          footer           column_info_t[nColumns]
+
+\********************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+
+#define COLUMN_HEADER   0
+#define COLUMN_EXTREMA  1
+#define COLUMN_WAVEFORM 2
+
+typedef struct {
+  char magic[4];               // "DRSC"
+  unsigned int version;
+  unsigned int nBoards;
+  unsigned int nBins;
+  unsigned short range;        // input range center in mV
+  unsigned short reserved;
+} column_file_header_t;
+
+typedef struct {
+  char magic[4];               // "CHNK"
+  unsigned int nEvents;
+  unsigned int nColumns;
+  unsigned int reserved;
+  unsigned long long size;     // whole chunk including footer
+} column_chunk_header_t;
+
+typedef struct {
+  unsigned short kind;         // COLUMN_xxx
+  unsigned char board;
+  unsigned char channel;
+  unsigned int reserved;
+  unsigned long long offset;   // from the start of the chunk
+  unsigned long long size;
+  float min;                   // serials for the header column,
+  float max;                   // ADC codes otherwise
+} column_info_t;
+
+class ColumnWriter {
+  int fFd;
+  int fNBoards;
+  int fNBins;
+  int fChunkEvents;
+  int fNEvents;
+  int *fSerial;
+  long long *fTime;
+  unsigned short *fTriggerCell;
+  unsigned short *fExtrema;
+  unsigned short *fWaveform;
+
+  ColumnWriter(const ColumnWriter &c);              // not implemented
+  ColumnWriter &operator=(const ColumnWriter &rhs); // not implemented
+
+public:
+  ColumnWriter(int nBoards, int nBins, int chunkEvents);
+  ~ColumnWriter();
+
+  // write the file header, timeHeader is the "TIME" block of SaveWaveforms
+  int  Open(int fd, unsigned short range, const unsigned char *timeHeader, int size);
+  // adc holds nBoards * 4 * nBins samples, returns bytes written (0 if buffered)
+  int  AddEvent(int serial, long long timeMs, const int *triggerCell, const unsigned short *adc);
+  int  Flush();
+  int  GetBufferedEvents() const { return fNEvents; }
+};
+
+class ColumnReader {
+  FILE *fFile;
+  column_file_header_t fHeader;
+  long fChunkStart;
+  column_chunk_header_t fChunk;
+  column_info_t *fInfo;
+  float *fTcal;
+
+  ColumnReader(const ColumnReader &c);              // not implemented
+  ColumnReader &operator=(const ColumnReader &rhs); // not implemented
+
+  const column_info_t *Find(int kind, int b, int ch) const;
+  int  ReadColumn(const column_info_t *c, void *buffer);
+
+public:
+  ColumnReader();
+  ~ColumnReader();
+
+  bool Open(const char *filename);
+  void Close();
+  const column_file_header_t &GetFileHeader() const { return fHeader; }
+  int  GetTimeCalibration(int b, int ch, float *tcal) const;
+
+  // advance to the next chunk, returns its number of events (0 at end)
+  int  NextChunk();
+  int  GetNumberOfColumns() const { return fChunk.nColumns; }
+  const column_info_t *GetColumnInfo(int i) const { return &fInfo[i]; }
+  // chunk level statistics of a channel, allows skipping whole chunks
+  bool GetRange(int b, int ch, float *min, float *max) const;
+
+  // each call seeks to and reads only the requested column
+  int  ReadHeader(int *serial, long long *timeMs, unsigned short *triggerCell);
+  int  ReadExtrema(int b, int ch, unsigned short *min, unsigned short *max);
+  int  ReadWaveforms(int b, int ch, unsigned short *adc);
+};
@@ -0,0 +1,37 @@
+/********************************************************************\
+
+Name:         control.h
+
+Contents:     Run control over a named pipe. Commands are text lines,
+              any process can send them with echo. The pipe is opened
+              read-write, so it never reports end-of-file between
+              writers and a blocking wait works without polling.
+
+\********************************************************************/
+
+#pragma once
+
+class ControlChannel {
+  int fFd;
+  char fBuffer[4096];
+  int fLength;
+
+  ControlChannel(const ControlChannel &c);              // not implemented
+  ControlChannel &operator=(const ControlChannel &rhs); // not implemented
+
+public:
+  ControlChannel();
+  ~ControlChannel();
+
+  // create the pipe if it does not exist
+  bool Open(const char *path);
+  void Close();
+  bool IsOpen() const { return fFd > 0; }
+
+  // read what arrived, waiting up to timeoutMs (0 = do not wait)
+  int  Read(int timeoutMs);
+  // pop the first complete line, without the newline
+  bool GetLine(char *line, int size);
+  // true if a queued line equals command, remove removes it
+  bool Find(const char *command, bool remove = false);
+};
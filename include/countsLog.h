@@ -0,0 +1,129 @@
+/********************************************************************\
+
+Name:         countsLog.h
+
+Contents:     Binary per-event counts stream. Every event is stored as
+              a fixed size record with a monotonic timestamp, so counts
+              can be rebinned offline at any interval. The per-minute
+              text file is produced from the same records by
+              CountsBinner.
+
+  File    counts_header_t, then count_record_t per event
+
+\********************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+
+// class numbers as stored in count_record_t::classification
+#define CLASS_NONE      -1
+#define CLASS_NEUTRON    0
+#define CLASS_MUON       1
+#define N_CLASSES        2
+
+static const char *const className[N_CLASSES] = {"neutrons", "muons"};
+// column order of the per-minute lines after the total
+static const int classColumn[N_CLASSES] = {CLASS_MUON, CLASS_NEUTRON};
+
+typedef struct {
+  char magic[4];                // "DRSN"
+  unsigned int version;
+  unsigned int recordSize;      // sizeof(count_record_t) of the writer
+  unsigned int reserved;
+  long long startWall;          // wall clock (ns since epoch) at time 0
+} counts_header_t;
+
+// count_record_t flags
+#define COUNT_FLAG_PSD  0x01            // psd holds a pulse shape value
+#define COUNT_FLAG_DT   0x02            // dt holds a top-bottom difference
+#define COUNT_FLAG_VETO 0x04            // rejected by the raw ADC veto
+#define COUNT_FLAG_PILEUP 0x08          // more than one pulse on a pad
+#define COUNT_FLAG_TIME(ch) (0x10 << (ch)) // pulseTime[ch] holds a time
+
+typedef struct {
+  unsigned long long time;      // ns since run start, CLOCK_MONOTONIC
+  unsigned int serial;
+  signed char classification;   // CLASS_xxx, CLASS_NONE if not classified
+  unsigned char flags;
+  unsigned char multiplicity;    // most hits inside the coincidence window
+  unsigned char pairMask;        // bit i: pairDt[i] inside its window
+  float amplitude[4];           // pulse height per channel in mV, 0 if not measured
+  float psd;                    // tail / total charge of the larger pulse
+  float pulseTime[4];           // constant fraction time per channel in ns
+  float dt;                     // pulseTime[1] - pulseTime[0]
+  float pairDt[4];              // time B - time A of the coincidence pairs
+  unsigned char nPeaks[4];      // pulses per channel, 0 without the peak finder
+} count_record_t;
+
+typedef struct {
+  unsigned long long start;     // ns since run start
+  unsigned long long end;
+  int total;
+  int count[N_CLASSES];         // per CLASS_xxx
+} counts_bin_t;
+
+// nanoseconds on the monotonic clock
+unsigned long long MonotonicNs();
+
+// "total <class counts in classColumn order> " of a per-minute line
+void PrintBinCounts(FILE *f, const counts_bin_t &bin);
+
+class CountsWriter {
+  int fFd;
+  int fNRecords;
+  int fSize;
+  long fBytes;
+  count_record_t *fBuffer;
+
+  CountsWriter(const CountsWriter &c);              // not implemented
+  CountsWriter &operator=(const CountsWriter &rhs); // not implemented
+
+public:
+  CountsWriter(int bufferedRecords = 4096);
+  ~CountsWriter();
+
+  bool Open(const char *filename, long long startWall);
+  void Close();
+  // records are collected in memory and written in blocks
+  int  Add(const count_record_t &r) {
+    fBuffer[fNRecords++] = r;
+    return fNRecords == fSize ? Flush() : 0;
+  }
+  int  Flush();
+  bool IsOpen() const { return fFd > 0; }
+  // size of the file, including the records not yet written
+  long GetBytes() const { return fBytes + fNRecords * (long)sizeof(count_record_t); }
+};
+
+class CountsReader {
+  FILE *fFile;
+  counts_header_t fHeader;
+
+  CountsReader(const CountsReader &c);              // not implemented
+  CountsReader &operator=(const CountsReader &rhs); // not implemented
+
+public:
+  CountsReader();
+  ~CountsReader();
+
+  bool Open(const char *filename);
+  void Close();
+  const counts_header_t &GetHeader() const { return fHeader; }
+  // 1 = record read, 0 = end of file
+  int  Read(count_record_t *r);
+};
+
+class CountsBinner {
+  unsigned long long fWidth;
+  counts_bin_t fBin;
+
+public:
+  CountsBinner(double seconds);
+
+  // close every bin that ends at or before time t, calling emit for each,
+  // returns the number of bins closed
+  int  Advance(unsigned long long t, void (*emit)(const counts_bin_t &bin, void *arg), void *arg);
+  void Add(int classification);
+  const counts_bin_t &GetCurrent() const { return fBin; }
+};
@@ -18,6 +18,27 @@ typedef struct trigger_t {
   double triggerDelay;       // Trigger delay from start of sample window
 } trigger_t;
 
+// The settings of one run, the positional arguments
+typedef struct {
+  double sampleSpeed;        // GS/s
+  double rangeCenter;        // V
+  trigger_t trigger;
+  long maxEvents;
+  long maxTime;              // seconds
+  char filepath[64];
+  bool waveformDisplay;
+  bool particleID;
+  bool scalersOnly;
+} run_config_t;
+
+// One board for InitBoard() / SetupBoard(), possibly on its own thread
+typedef struct {
+  DRSBoard* board;
+  int index;
+  const run_config_t* run;
+  bool threaded;
+} board_setup_t;
+
 DRS      *m_drs;
 int m_evSerial = 1;
 int m_nBoards = 4;
@@ -43,13 +64,156 @@ bool m_clkOn = false;
 double m_samplingSpeed = 1;
 int  m_chnOffset = 0;
 
+// Zero suppression: keep only windows around samples beyond threshold
+bool m_zeroSuppress = false;
+double m_zsThreshold = 10;   // mV from baseline
+int m_zsPre = 16;            // samples kept before a crossing
+int m_zsPost = 32;           // samples kept after a crossing
+
+// Output file rotation, 0 = disabled
+long m_rotateBytes = 0;
+long m_rotateSeconds = 0;
+long m_rotateEvents = 0;
+long m_fileBytes = 0;
+long m_fileEvents = 0;
+time_t m_fileOpened = 0;
+int m_filePart = 0;
+bool m_timeHeader = true;
+
+// Columnar output, events per chunk (0 = record per event)
+int m_chunkEvents = 0;
+ColumnWriter *m_columns = NULL;
+long long m_evTimeMs = 0;
+
+// Particle ID: baseline window from bin 0 and muon pulse height
+int m_baselineBins = 64;
+double m_muonThreshold = 20;   // mV below baseline
+pulse_t m_pulse[MAX_N_BOARDS][4];
+
+// Multi-peak finder on the pads, 0 = off
+#define MAX_N_PEAKS 16
+float m_peakThreshold = 0;     // mV below baseline
+float m_peakHysteresis = 5;    // mV
+bool m_rejectPileup = false;
+peak_t m_peaks[MAX_N_BOARDS][4][MAX_N_PEAKS];
+int m_nPeaks[MAX_N_BOARDS][4];
+long m_pileupEvents = 0;
+
+// Baselines tracked over events, used by the pulse search and ZS
+bool m_trackBaseline = false;
+float m_baselineAlpha = 0.01;
+bool m_baselinePerCell = false;
+// pedestal-corrected copy of m_waveform for the pulse analysis, the
+// acquisition buffer is saved as read
+float m_pulseWave[MAX_N_BOARDS][4][2048];
+BaselineTracker *m_baseline[MAX_N_BOARDS][4];
+double m_cfdFraction = 0.5;    // of the amplitude, for pulse times and PSD
+
+// Pulse shape discrimination, windows in ns relative to the CFD edge
+bool m_psd = false;
+float m_psdPre = 10;
+float m_psdPrompt = 30;
+float m_psdTotal = 200;
+double m_psdCut = 0.2;
+psd_t m_psdResult;
+
+// Software coincidences across channels and boards
+bool m_coincidence = false;
+CoincidenceBuilder m_coinc(10);   // ns
+
+// Event classifier, CLASSIFIER_xxx, -1 = chosen from the options
+int m_classifier = -1;
+classifier_config_t m_classifierConfig;
+
+// Raw ADC veto ahead of calibration
+bool m_veto = false;
+float m_vetoThreshold = 0;     // mV below baseline
+int m_vetoSamples = 1;         // samples beyond threshold in any channel
+long m_vetoChecked = 0;
+long m_vetoRejected = 0;
+unsigned long long m_vetoNs = 0;
+unsigned long long m_calibrateNs = 0;
+
+// Waveforms saved in counts mode, see prescaler.h
+Prescaler m_prescaler;
+int m_prescaleFd = 0;
+
+// Online histograms, written to m_histFile every m_histInterval seconds
+char m_histFile[1024] = "";
+long m_histInterval = 60;
+Histogram *m_hist[16];
+int m_nHist = 0;
+volatile int m_histSnapshot = 0;   // set by SIGUSR1
+
+// Live time accounting, rates written every m_rateInterval seconds
+LiveTimeMeter m_live;
+long m_rateInterval = 0;
+FILE *m_rateFile = NULL;
+
+// Initialize and configure the boards on one thread each
+bool m_parallelInit = false;
+
+// Run control, see control.h
+char m_controlFile[1024] = "";
+ControlChannel m_control;
+volatile int m_stopRun = 0;
+
+// Wall clock (ns since epoch) at the monotonic time 0 of the run
+long long m_runStartWall = 0;
+
+int OpenOutput(char* filename, const char* filepath, trigger_t& trigger);
+bool RotationDue(long bytes);
 int SaveWaveforms(int fd);
+int SaveColumns(int fd);
+unsigned char *WriteTimeHeader(unsigned char *p);
+void CloseOutput(int fd);
+int EncodeWaveform(int b, int i, unsigned short *d);
+unsigned char *WriteZeroSuppressed(unsigned char *p, int b, int i, unsigned short *d, int n);
 void GetTimeStamp(TIMESTAMP &ts);
 void ReadWaveforms();
+void TransferWaveforms();
+void CalibrateWaveforms();
+bool PassesVeto();
+bool ReadAcceptedWaveforms();
+void PrintVetoStatistics();
 int GetWaveformDepth(int channel);
 double GetSamplingSpeed();
 DRSBoard *GetBoard(int i){ return m_drs->GetBoard(i); }
 double GetWaveformLength()    { return m_waveDepth / GetSamplingSpeed(); }
 int setTrigger(DRSBoard* board, trigger_t trigger);
 void exitGracefully(int sig);
-int searchWaveforms();
+void ReplaceExtension(char* name, int size, const char* filename, const char* ext);
+bool OpenRates(const char* filename, bool scalers = false);
+void ArmLiveTime(unsigned long long t);
+void WriteRates(const live_interval_t& r, const double* scalers = NULL, int nScalers = 0);
+void PrintLiveTime(unsigned long long t);
+bool OpenPrescaled(const char* filename);
+bool OpenCounts(CountsWriter& counts, const char* filename);
+void PrintCounts(FILE* data, const counts_bin_t& bin, time_t label, const double* scalers = NULL,
+                 int nScalers = 0);
+void WriteMinute(const counts_bin_t& bin, void* arg);
+void FindCoincidences(count_record_t& record);
+void BookHistograms();
+void FillHistograms(const count_record_t& r);
+void SnapshotHistograms();
+void PollSnapshot(unsigned long long t, unsigned long long& nextSnapshot);
+void requestSnapshot(int sig);
+void UpdateBaselines();
+void MeasurePulse(int b, int i);
+float *PulseWaveform(int b, int i);
+void searchWaveforms(count_record_t &record);
+int ParseRunArguments(char** argv, run_config_t& run);
+void* InitBoard(void* arg);
+void* SetupBoard(void* arg);
+void ForEachBoard(DRS* drs, const run_config_t& run, void* (*work)(void*));
+void ApplyRunConfig(DRS* drs, const run_config_t& next, const run_config_t& current);
+int Serve(DRS* drs, run_config_t& run);
+int Run(DRS* drs, run_config_t& run);
+bool StopRequested();
+void ResetRunState();
+int CountScalers(DRS* drs, const char* filepath, trigger_t& trigger, long maxTime, struct timeval startTime);
+int TriggerScaler(const trigger_t& trigger);
+void CloseCountsOutput(FILE* data);
+template <class Classifier>
+int CountEvents(DRS* drs, const char* filepath, trigger_t& trigger, bool particleID, long maxTime,
+                struct timeval startTime);
@@ -0,0 +1,74 @@
+/********************************************************************\
+
+Name:         drsReader.h
+
+Contents:     Reader for the binary event files written by drsLog.
+              Full and zero-suppressed channel records are both
+              accepted; suppressed traces are rebuilt on demand.
+
+\********************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+
+#define READER_MAX_BOARDS 4
+#define READER_N_CHANNELS 4
+#define READER_N_BINS     1024
+
+typedef struct {
+  int serial;
+  unsigned short year, month, day;
+  unsigned short hour, minute, second, millisecond;
+  unsigned short range;                  // input range center in mV
+} event_header_t;
+
+typedef struct {
+  bool present;                          // channel found in the record
+  bool suppressed;                       // stored as "Z" record
+  bool empty;                            // suppressed with no window
+  unsigned short baseline;               // fill value outside the windows
+  int nWindows;
+  unsigned short winStart[READER_N_BINS / 2 + 1];
+  unsigned short winLength[READER_N_BINS / 2 + 1];
+  unsigned short data[READER_N_BINS];    // window samples, packed
+} channel_record_t;
+
+class DRSReader {
+  FILE *fFile;
+  int fNBoards;
+  int fSerial[READER_MAX_BOARDS];
+  int fTriggerCell[READER_MAX_BOARDS];
+  bool fHasTime[READER_MAX_BOARDS];
+  int fTimeSerial[READER_MAX_BOARDS];
+  float fTcal[READER_MAX_BOARDS][READER_N_CHANNELS][READER_N_BINS];
+  event_header_t fHeader;
+  channel_record_t fChannel[READER_MAX_BOARDS][READER_N_CHANNELS];
+
+  bool Peek(char *tag, int n);
+  bool ReadTimeHeader();
+  bool ReadChannel(channel_record_t *c, bool suppressed);
+
+public:
+  DRSReader();
+  ~DRSReader();
+
+  bool Open(const char *filename);
+  void Close();
+
+  // 1 = event read, 0 = end of file, -1 = corrupt record
+  int  ReadEvent();
+
+  const event_header_t &GetHeader() const { return fHeader; }
+  int  GetNumberOfBoards() const { return fNBoards; }
+  int  GetBoardSerialNumber(int b) const { return fSerial[b]; }
+  int  GetTriggerCell(int b) const { return fTriggerCell[b]; }
+  bool IsSuppressed(int b, int ch) const { return fChannel[b][ch].suppressed; }
+  bool IsEmpty(int b, int ch) const { return fChannel[b][ch].empty; }
+  int  GetStoredSamples(int b, int ch) const;
+
+  // Rebuild the full 1024 sample trace of a channel
+  int  GetWaveform(int b, int ch, unsigned short *adc) const;
+  int  GetWaveform(int b, int ch, float *mV) const;
+  int  GetTimeCalibration(int b, int ch, float *tcal) const;
+};
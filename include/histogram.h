@@ -0,0 +1,69 @@
+/********************************************************************\
+
+Name:         histogram.h
+
+Contents:     Fixed binning 1D and 2D histograms for online spectra.
+              Each filling thread owns a shard of the bins and is the
+              only writer to it, so a fill is a plain increment. A
+              snapshot sums the shards with relaxed atomic loads, it
+              can run in any thread without stopping the fills.
+
+  Snapshot file, per histogram:
+          # <name> <nx> <xmin> <xmax> [<ny> <ymin> <ymax>]
+          <x> [<y>] <count>           one line per bin, bin centers
+          # underflow <n> overflow <n>
+
+\********************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+
+class Histogram {
+  char fName[32];
+  int fNx, fNy;
+  float fXmin, fXmax, fYmin, fYmax;
+  float fXscale, fYscale;
+  int fNShards;
+  int fSize;                    // bins per shard including under/overflow
+  unsigned int *fBins;
+
+  Histogram(const Histogram &c);              // not implemented
+  Histogram &operator=(const Histogram &rhs); // not implemented
+
+  void Init(const char *name, int nx, float xmin, float xmax, int ny, float ymin, float ymax,
+            int nShards);
+  // 0 = underflow, n + 1 = overflow, NaN counts as underflow
+  static int Bin(float v, float min, float scale, int n) {
+    if (!(v >= min))
+      return 0;
+    float f = (v - min) * scale;
+    return f < n ? (int)f + 1 : n + 1;
+  }
+
+public:
+  Histogram(const char *name, int nx, float xmin, float xmax, int nShards = 1);
+  Histogram(const char *name, int nx, float xmin, float xmax, int ny, float ymin, float ymax,
+            int nShards = 1);
+  ~Histogram();
+
+  // only one thread may fill a given shard
+  void Fill(float x, int shard = 0) {
+    unsigned int *b = fBins + shard * fSize + Bin(x, fXmin, fXscale, fNx);
+    __atomic_store_n(b, *b + 1, __ATOMIC_RELAXED);
+  }
+  void Fill2D(float x, float y, int shard = 0) {
+    unsigned int *b = fBins + shard * fSize + Bin(y, fYmin, fYscale, fNy) * (fNx + 2) +
+                      Bin(x, fXmin, fXscale, fNx);
+    __atomic_store_n(b, *b + 1, __ATOMIC_RELAXED);
+  }
+
+  const char *GetName() const { return fName; }
+  int  GetSize() const { return fSize; }
+  // sum of all shards, sum holds GetSize() values
+  void Snapshot(unsigned int *sum) const;
+  void Write(FILE *f) const;
+};
+
+// write all histograms to filename.tmp, then rename it over filename
+bool WriteHistograms(const char *filename, Histogram **h, int n);
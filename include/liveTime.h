@@ -0,0 +1,52 @@
+/********************************************************************\
+
+Name:         liveTime.h
+
+Contents:     Live time and dead time of the acquisition loop. The
+              loop reports when the boards are armed and when a
+              trigger ended the wait; time armed is live, everything
+              else (readout, processing, output) is dead. Intervals of
+              fixed length give live-time-corrected rates.
+
+\********************************************************************/
+
+#pragma once
+
+typedef struct {
+  unsigned long long start;     // ns since run start
+  unsigned long long end;
+  long events;
+  unsigned long long live;      // ns armed
+  unsigned long long dead;      // ns between trigger and re-arm
+} live_interval_t;
+
+class LiveTimeMeter {
+  unsigned long long fInterval;
+  unsigned long long fMark;     // last arm or trigger
+  bool fArmed;
+  live_interval_t fCurrent;
+  live_interval_t fTotal;
+
+  void Reset(live_interval_t &i, unsigned long long t);
+
+public:
+  LiveTimeMeter(double seconds = 0);
+
+  void SetInterval(double seconds) { fInterval = (unsigned long long)(seconds * 1E9); }
+  void Start(unsigned long long t);
+  // boards started, dead time ends
+  void Arm(unsigned long long t);
+  // wait ended by a trigger, live time ends; fake triggers are not events
+  void Trigger(unsigned long long t, bool event = true);
+
+  // interval length reached, only checked right after Arm()
+  bool Due(unsigned long long t) const { return fInterval && t - fCurrent.start >= fInterval; }
+  // close the current interval at t and start the next one
+  live_interval_t Close(unsigned long long t);
+  live_interval_t GetTotal(unsigned long long t) const;
+};
+
+// events per second of live time
+inline double LiveRate(const live_interval_t &i) {
+  return i.live ? i.events / (i.live / 1E9) : 0;
+}
@@ -0,0 +1,39 @@
+/********************************************************************\
+
+Name:         prescaler.h
+
+Contents:     Waveform prescaler for the counts mode. Every event is
+              counted and classified, only a subset of the waveforms
+              is written. Each class has its own factor: 1 keeps every
+              event, n every n-th, 0 none. Random sampling keeps each
+              event with probability 1/n instead, so periodic sources
+              do not alias with the prescaler.
+
+\********************************************************************/
+
+#pragma once
+
+#include "classifier.h"
+
+class Prescaler {
+  int fFactor[N_CLASSES + 1];   // [0] events without class
+  long fCount[N_CLASSES + 1];
+  long fSaved[N_CLASSES + 1];
+  bool fRandom;
+  unsigned int fState;
+
+public:
+  Prescaler();
+
+  void SetFactor(int c, int factor) { fFactor[c + 1] = factor; }
+  void SetAll(int factor);
+  void SetRandom(bool random) { fRandom = random; }
+  // "n" for every class or "class=n" pairs, comma separated
+  bool Parse(const char *spec);
+  void ResetCounts();
+
+  bool IsActive() const;
+  // true if the waveform of this event is to be written
+  bool Accept(int c);
+  void Print() const;
+};
@@ -0,0 +1,70 @@
+/********************************************************************\
+
+Name:         pulseFinder.h
+
+Contents:     Peak search on calibrated waveforms. The baseline is
+              estimated per channel from a pre-trigger window, the peak
+              is the minimum of the trace (PMT pulses are negative).
+              Pulse shape discrimination integrates the charge in a
+              prompt and a tail window after the leading edge.
+
+\********************************************************************/
+
+#pragma once
+
+typedef struct {
+  float baseline;      // mV, clipped mean of the baseline window
+  float baselineRms;   // mV
+  float amplitude;     // mV below the baseline
+  int   peakBin;
+  float peakTime;      // ns from the time array, the bin number without one
+} pulse_t;
+
+typedef struct {
+  float amplitude;     // mV below the baseline
+  int   bin;
+  float time;          // ns, the bin number without a time array
+} peak_t;
+
+typedef struct {
+  float start;         // fractional bin of the constant fraction crossing
+  float prompt;        // mV * ns from start - pre to start + prompt
+  float total;         // mV * ns from start - pre to start + total
+  float psd;           // tail / total, 0 without charge
+} psd_t;
+
+// index of the first minimum of wf[0..n), its value is returned in *min
+int  FindMinimum(const float *wf, int n, float *min);
+
+// baseline from bins [first, first + nBins), then the largest pulse;
+// time may be NULL
+void FindPulse(const float *wf, const float *time, int n, int first, int nBins, pulse_t *p);
+// the largest pulse below a known baseline, e.g. from a BaselineTracker
+void FindPulseAt(const float *wf, const float *time, int n, float baseline, float rms, pulse_t *p);
+
+// fractional bin where the leading edge before the peak crosses
+// fraction * amplitude, -1 if it is not found
+float FindLeadingEdge(const float *wf, const pulse_t *p, float fraction);
+
+// time of the constant fraction crossing, interpolated on the time array
+// (the fractional bin without one), -1 if no crossing is found
+float CfdTime(const float *wf, const float *time, const pulse_t *p, float fraction);
+
+// CfdTime for nChannels traces and time arrays stride floats apart
+void CfdTimes(const float *wf, const float *time, int stride, int nChannels, const pulse_t *p,
+              float fraction, float *t);
+
+// running sum of (baseline - wf), sum[0] = 0, sum holds n + 1 values
+void PrefixSum(const float *wf, int n, float baseline, float *sum);
+
+// charge integrals around the constant fraction start, windows in ns;
+// the bin width is taken from time if given, otherwise binWidth is used
+void ComputePsd(const float *wf, const float *time, int n, const pulse_t *p, float fraction,
+                float pre, float prompt, float total, float binWidth, psd_t *psd);
+
+// all pulses below baseline - threshold; a pulse ends when the trace
+// has risen by hysteresis from its peak, a new one starts when it falls
+// again by hysteresis from the valley, so piled-up pulses are separated.
+// Returns the number of peaks, of which up to maxPeaks are stored
+int  FindPeaks(const float *wf, const float *time, int n, float baseline, float threshold,
+               float hysteresis, peak_t *peak, int maxPeaks);
@@ -31,9 +31,12 @@
 #pragma warning(disable:4996)
 #   include <windows.h>
 #   include <direct.h>
+#   include <io.h>
 #else
 #   include <unistd.h>
 #   include <sys/time.h>
+#   include <dirent.h>
+#   include <pthread.h>
 inline void Sleep(useconds_t x)
 {
    usleep(x * 1000);
@@ -147,7 +150,6 @@ using namespace std;
 
 #ifdef HAVE_USB
 #define USB2_BUFFER_SIZE (1024*1024+10)
-unsigned char static *usb2_buffer = NULL;
 #endif
 
 /*------------------------------------------------------------------*/
@@ -379,13 +381,6 @@ DRS::~DRS()
       delete fBoard[i];
    }
 
-#ifdef HAVE_USB
-   if (usb2_buffer) {
-      free(usb2_buffer);
-      usb2_buffer = NULL;
-   }
-#endif
-
 #ifdef HAVE_VME
    mvme_close(fVmeInterface);
 #endif
@@ -618,6 +613,8 @@ DRSBoard::~DRSBoard()
       delete fTimeData[i];
    }
    delete[]fTimeData;
+
+   free(fUsb2Buffer);
 }
 
 /*------------------------------------------------------------------*/
@@ -633,6 +630,10 @@ void DRSBoard::ConstructBoard()
 
    fExternalClockFrequency = 1000. / 30.;
    strcpy(fCalibDirectory, ".");
+   fUsb2Buffer = NULL;
+   fLockPending = false;
+   fLockPolls = 0;
+   fLockResult = 1;
 
    /* check board communication */
    if (Read(T_STATUS, buffer, REG_MAGIC, 2) < 0) {
@@ -834,7 +835,170 @@ void DRSBoard::ReadSerialNumber()
 
 /*------------------------------------------------------------------*/
 
+/* calibration cache: decoded tables of one board, keyed by the EEPROM
+   calibration header, so a restart needs a single small EEPROM read */
+
+#define CALIB_CACHE_MAGIC   "DRSK"
+#define CALIB_CACHE_VERSION 1
+#define CALIB_CACHE_HEADER  32   // bytes of EEPROM page 0 used as key
+
+typedef struct {
+   char           magic[4];
+   unsigned int   version;
+   unsigned int   size;           // bytes following this header
+   unsigned int   checksum;       // of those bytes
+   int            serial;
+   int            boardType;
+   unsigned short eeprom[CALIB_CACHE_HEADER / 2];
+} calib_cache_header_t;
+
+static unsigned int CalibrationChecksum(const unsigned char *p, unsigned int n)
+{
+   // Fletcher-32 over bytes, catches truncated and overwritten files
+   unsigned int a = 1, b = 0;
+
+   while (n) {
+      unsigned int len = n > 5552 ? 5552 : n;
+      n -= len;
+      while (len--) {
+         a += *p++;
+         b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+   }
+   return (b << 16) | a;
+}
+
+void DRSBoard::GetCalibrationCacheName(char *name, int size)
+{
+   snprintf(name, size, "%s/drs4_calib_%d.cache", fCalibDirectory, fBoardSerialNumber);
+}
+
+/*------------------------------------------------------------------*/
+
+bool DRSBoard::ReadCalibrationCache(const unsigned short *eeprom)
+{
+   char name[1100];
+   calib_cache_header_t h;
+   unsigned int size;
+
+   GetCalibrationCacheName(name, sizeof(name));
+   FILE *f = fopen(name, "rb");
+   if (f == NULL)
+      return false;
+
+   size = sizeof(fVoltageCalibrationValid) + 3 * sizeof(double) + sizeof(fCellOffset) +
+          sizeof(fCellGain) + sizeof(fCellOffset2) + sizeof(fCellDT);
+   unsigned char *buffer = (unsigned char *)malloc(size);
+   bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+             memcmp(h.magic, CALIB_CACHE_MAGIC, 4) == 0 &&
+             h.version == CALIB_CACHE_VERSION && h.size == size &&
+             h.serial == fBoardSerialNumber && h.boardType == fBoardType &&
+             memcmp(h.eeprom, eeprom, CALIB_CACHE_HEADER) == 0 &&
+             buffer != NULL && fread(buffer, 1, size, f) == size &&
+             CalibrationChecksum(buffer, size) == h.checksum;
+   fclose(f);
+
+   if (ok) {
+      unsigned char *p = buffer;
+      memcpy(&fVoltageCalibrationValid, p, sizeof(fVoltageCalibrationValid));
+      p += sizeof(fVoltageCalibrationValid);
+      memcpy(&fCellCalibratedRange, p, sizeof(double));
+      p += sizeof(double);
+      memcpy(&fCellCalibratedTemperature, p, sizeof(double));
+      p += sizeof(double);
+      memcpy(&fTimingCalibratedFrequency, p, sizeof(double));
+      p += sizeof(double);
+      memcpy(fCellOffset, p, sizeof(fCellOffset));
+      p += sizeof(fCellOffset);
+      memcpy(fCellGain, p, sizeof(fCellGain));
+      p += sizeof(fCellGain);
+      memcpy(fCellOffset2, p, sizeof(fCellOffset2));
+      p += sizeof(fCellOffset2);
+      memcpy(fCellDT, p, sizeof(fCellDT));
+   }
+   free(buffer);
+   return ok;
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSBoard::WriteCalibrationCache(const unsigned short *eeprom)
+{
+   char name[1100], tmp[1110];
+   calib_cache_header_t h;
+   unsigned int size;
+
+   size = sizeof(fVoltageCalibrationValid) + 3 * sizeof(double) + sizeof(fCellOffset) +
+          sizeof(fCellGain) + sizeof(fCellOffset2) + sizeof(fCellDT);
+   unsigned char *buffer = (unsigned char *)malloc(size);
+   if (buffer == NULL)
+      return;
+
+   unsigned char *p = buffer;
+   memcpy(p, &fVoltageCalibrationValid, sizeof(fVoltageCalibrationValid));
+   p += sizeof(fVoltageCalibrationValid);
+   memcpy(p, &fCellCalibratedRange, sizeof(double));
+   p += sizeof(double);
+   memcpy(p, &fCellCalibratedTemperature, sizeof(double));
+   p += sizeof(double);
+   memcpy(p, &fTimingCalibratedFrequency, sizeof(double));
+   p += sizeof(double);
+   memcpy(p, fCellOffset, sizeof(fCellOffset));
+   p += sizeof(fCellOffset);
+   memcpy(p, fCellGain, sizeof(fCellGain));
+   p += sizeof(fCellGain);
+   memcpy(p, fCellOffset2, sizeof(fCellOffset2));
+   p += sizeof(fCellOffset2);
+   memcpy(p, fCellDT, sizeof(fCellDT));
+
+   memcpy(h.magic, CALIB_CACHE_MAGIC, 4);
+   h.version = CALIB_CACHE_VERSION;
+   h.size = size;
+   h.checksum = CalibrationChecksum(buffer, size);
+   h.serial = fBoardSerialNumber;
+   h.boardType = fBoardType;
+   memcpy(h.eeprom, eeprom, CALIB_CACHE_HEADER);
+
+   // write aside and rename, a concurrent start never sees half a file
+   GetCalibrationCacheName(name, sizeof(name));
+   snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+   FILE *f = fopen(tmp, "wb");
+   if (f != NULL) {
+      bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(buffer, 1, size, f) == size;
+      ok = (fclose(f) == 0) && ok;
+      if (ok)
+         rename(tmp, name);
+      else
+         remove(tmp);
+   }
+   free(buffer);
+}
+
+/*------------------------------------------------------------------*/
+
 void DRSBoard::ReadCalibration(void)
+{
+   unsigned short eeprom[CALIB_CACHE_HEADER / 2];
+
+   // the calibration header on EEPROM page 0 changes with every
+   // calibration, a matching cache spares the full page reads
+   memset(eeprom, 0, sizeof(eeprom));
+   if (fBoardType == 5 || fBoardType == 6 || fBoardType == 7 || fBoardType == 8 || fBoardType == 9) {
+      ReadEEPROM(0, eeprom, sizeof(eeprom));
+      if (ReadCalibrationCache(eeprom))
+         return;
+   }
+
+   ReadCalibrationEEPROM();
+   if (fVoltageCalibrationValid)
+      WriteCalibrationCache(eeprom);
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSBoard::ReadCalibrationEEPROM(void)
 {
    unsigned short buf[1024*16]; // 32 kB
    int i, j, chip;
@@ -1250,9 +1414,11 @@ int DRSBoard::Write(int type, unsigned int addr, void *data, int size)
       unsigned int base_addr;
       int i;
 
-      if (usb2_buffer == NULL)
-         usb2_buffer = (unsigned char *) malloc(USB2_BUFFER_SIZE);
-      assert(usb2_buffer);
+      /* one buffer per board, boards may be written from several threads */
+      if (fUsb2Buffer == NULL)
+         fUsb2Buffer = (unsigned char *) malloc(USB2_BUFFER_SIZE);
+      assert(fUsb2Buffer);
+      unsigned char *usb2_buffer = fUsb2Buffer;
 
       /* only accept even address and number of bytes */
       assert(addr % 2 == 0);
@@ -2666,6 +2832,62 @@ int DRSBoard::ConfigureLMK(double sampFreq, bool freqChange, int calFreq, int ca
 
 /*------------------------------------------------------------------*/
 
+void DRSBoard::StartFrequencyLock()
+{
+   /* the PLL regulates on a running domino wave */
+   StartDomino();
+   fLockPending = true;
+   fLockPolls = 0;
+}
+
+int DRSBoard::SetFrequencyAsync(double demand)
+{
+   /* only the DRS4 evaluation boards lock a PLL, others regulate in place */
+   if (fDRSType != 4 || fBoardType == 6)
+      return SetFrequency(demand, true);
+
+   if (!SetFrequency(demand, false))
+      return 0;
+   StartFrequencyLock();
+   return 1;
+}
+
+int DRSBoard::PollFrequencyLock()
+{
+   unsigned int status;
+
+   if (!fLockPending)
+      return fLockResult;
+
+   status = GetStatusReg();
+   if (status & BIT_PLL_LOCKED0) {
+      fLockResult = 1;
+   } else if (++fLockPolls == 1000) {
+      printf("PLL did not lock for frequency %lf\n", fNominalFrequency);
+      fLockResult = 0;
+   } else {
+      /* a trigger may have stopped the wave before the lock */
+      if ((status & BIT_RUNNING) == 0)
+         StartDomino();
+      return -1;
+   }
+
+   SoftTrigger();
+   fLockPending = false;
+   return fLockResult;
+}
+
+int DRSBoard::WaitFrequencyLock()
+{
+   int status;
+
+   while ((status = PollFrequencyLock()) < 0)
+      ;
+   return status;
+}
+
+/*------------------------------------------------------------------*/
+
 int DRSBoard::SetFrequency(double demand, bool wait)
 {
    // Set domino sampling frequency
@@ -2710,15 +2932,8 @@ int DRSBoard::SetFrequency(double demand, bool wait)
 
       /* wait for PLL lock if asked */
       if (wait) {
-         StartDomino();
-         for (i=0 ; i<1000 ; i++)
-            if (GetStatusReg() & BIT_PLL_LOCKED0)
-               break;
-         SoftTrigger();
-         if (i == 1000) {
-            printf("PLL did not lock for frequency %lf\n", demand);
-            return 0;
-         }
+         StartFrequencyLock();
+         return WaitFrequencyLock();
       }
    } else {                     // fDRSType == 4
       SetDominoMode(1);
@@ -4499,6 +4714,11 @@ int DRSBoard::WriteEEPROM(unsigned short page, void *buffer, int size)
    int i;
    unsigned long status;
    unsigned char buf[32768];
+   char name[1100];
+
+   // a new calibration is being stored, the cached tables are stale
+   GetCalibrationCacheName(name, sizeof(name));
+   remove(name);
 
    // read previous page
    ReadEEPROM(page, buf, sizeof(buf));
@@ -4695,20 +4915,210 @@ bool DRSBoard::InitTimeCalibration(unsigned int chipIndex)
 
 /*------------------------------------------------------------------*/
 
-DRSBoard::TimeData * DRSBoard::GetTimeCalibration(unsigned int chipIndex, bool reinit)
+DRSBoard::TimeData::FrequencyData * DRSBoard::TimeData::Add(int frequency)
 {
-   int i, l, index;
+   int i;
+
+   fFrequency = (FrequencyData **) realloc(fFrequency, (fNumberOfFrequencies + 1) * sizeof(FrequencyData *));
+   for (i = fNumberOfFrequencies; i > 0 && fFrequency[i - 1]->fFrequency > frequency; i--)
+      fFrequency[i] = fFrequency[i - 1];
+   fFrequency[i] = new FrequencyData();
+   fFrequency[i]->fFrequency = frequency;
+   fFrequency[i]->fModified = 0;
+   fFrequency[i]->fSize = 0;
+   fNumberOfFrequencies++;
+   return fFrequency[i];
+}
+
+void DRSBoard::TimeData::Remove(int i)
+{
+   delete fFrequency[i];
+   fNumberOfFrequencies--;
+   memmove(fFrequency + i, fFrequency + i + 1, (fNumberOfFrequencies - i) * sizeof(FrequencyData *));
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSBoard::ScanTimeCalibration(TimeData *init)
+{
+   char dir[1100], fileName[1400];
+   int serial, chip, frequency;
+   struct stat st;
+
+   /* one pass over the board directory instead of probing file names */
+   sprintf(dir, "%s/board%d", fCalibDirectory, fBoardSerialNumber);
+#ifdef _MSC_VER
+   struct _finddata_t fd;
+   sprintf(fileName, "%s/TimeCalib_board*.xml", dir);
+   intptr_t h = _findfirst(fileName, &fd);
+   if (h == -1)
+      return;
+   do {
+      const char *name = fd.name;
+#else
+   DIR *d = opendir(dir);
+   if (d == NULL)
+      return;
+   struct dirent *e;
+   while ((e = readdir(d)) != NULL) {
+      const char *name = e->d_name;
+#endif
+      char tail[8];
+      if (sscanf(name, "TimeCalib_board%d_chip%d_%dMHz%7s", &serial, &chip, &frequency, tail) != 4 ||
+          strcmp(tail, ".xml") != 0 || serial != fBoardSerialNumber || chip != init->fChip)
+         continue;
+      sprintf(fileName, "%s/%s", dir, name);
+      if (stat(fileName, &st) != 0)
+         continue;
+      DRSBoard::TimeData::FrequencyData * freq = init->Add(frequency);
+      freq->fModified = (long long) st.st_mtime;
+      freq->fSize = (long long) st.st_size;
+#ifdef _MSC_VER
+   } while (_findnext(h, &fd) == 0);
+   _findclose(h);
+#else
+   }
+   closedir(d);
+#endif
+}
+
+/*------------------------------------------------------------------*/
+
+bool DRSBoard::ReadTimeCalibrationXML(unsigned int chipIndex, int frequency, double *bin)
+{
+   int l;
    char *cstop;
-   char fileName[500];
+   char fileName[1400];
    char error[240];
    PMXML_NODE node, rootNode, mainNode;
 
+   sprintf(fileName, "%s/board%d/TimeCalib_board%d_chip%d_%dMHz.xml", fCalibDirectory, fBoardSerialNumber,
+           fBoardSerialNumber, chipIndex, frequency);
+   rootNode = mxml_parse_file(fileName, error, sizeof(error), NULL);
+   if (rootNode == NULL)
+      return false;
+
+   mainNode = mxml_find_node(rootNode, "/DRSTimeCalibration");
+   for (l = 0; l < kNumberOfBins; l++) {
+      node = mainNode ? mxml_subnode(mainNode, l + 2) : NULL;
+      if (node == NULL) {
+         mxml_free_tree(rootNode);
+         return false;
+      }
+      bin[l] = strtod(mxml_get_value(node), &cstop);
+   }
+   mxml_free_tree(rootNode);
+   return true;
+}
+
+/*------------------------------------------------------------------*/
+
+/* binary time calibration cache: "DRST" version n checksum, then per
+   frequency MHz, XML time and size, and the bins as doubles */
+
+#define TIME_CACHE_MAGIC   "DRST"
+#define TIME_CACHE_VERSION 1
+
+void DRSBoard::GetTimeCalibrationCacheName(unsigned int chipIndex, char *name, int size)
+{
+   snprintf(name, size, "%s/board%d/TimeCalib_board%d_chip%d.cache", fCalibDirectory, fBoardSerialNumber,
+            fBoardSerialNumber, chipIndex);
+}
+
+bool DRSBoard::ReadTimeCalibrationCache(TimeData *init)
+{
+   char name[1400];
+   char magic[4];
+   unsigned int header[3];
+   int i, n = init->fNumberOfFrequencies;
+   unsigned int size = n * (sizeof(int) + 2 * sizeof(long long) + kNumberOfBins * sizeof(double));
+
+   GetTimeCalibrationCacheName(init->fChip, name, sizeof(name));
+   FILE *f = fopen(name, "rb");
+   if (f == NULL)
+      return false;
+
+   unsigned char *buffer = (unsigned char *) malloc(size);
+   bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, TIME_CACHE_MAGIC, 4) == 0 &&
+             fread(header, sizeof(header), 1, f) == 1 && header[0] == TIME_CACHE_VERSION &&
+             header[1] == (unsigned int) n && buffer != NULL && fread(buffer, 1, size, f) == size &&
+             CalibrationChecksum(buffer, size) == header[2];
+   fclose(f);
+
+   /* every XML file must be the one the cache was made from */
+   unsigned char *p = buffer;
+   for (i = 0; ok && i < n; i++) {
+      DRSBoard::TimeData::FrequencyData * freq = init->fFrequency[i];
+      int frequency;
+      long long modified, fileSize;
+      memcpy(&frequency, p, sizeof(int));
+      p += sizeof(int);
+      memcpy(&modified, p, sizeof(long long));
+      p += sizeof(long long);
+      memcpy(&fileSize, p, sizeof(long long));
+      p += sizeof(long long);
+      ok = frequency == freq->fFrequency && modified == freq->fModified && fileSize == freq->fSize;
+      memcpy(freq->fBin, p, kNumberOfBins * sizeof(double));
+      p += kNumberOfBins * sizeof(double);
+   }
+   free(buffer);
+   return ok;
+}
+
+void DRSBoard::WriteTimeCalibrationCache(TimeData *init)
+{
+   char name[1400], tmp[1410];
+   unsigned int header[3];
+   int i, n = init->fNumberOfFrequencies;
+   unsigned int size = n * (sizeof(int) + 2 * sizeof(long long) + kNumberOfBins * sizeof(double));
+
+   unsigned char *buffer = (unsigned char *) malloc(size);
+   if (buffer == NULL)
+      return;
+   unsigned char *p = buffer;
+   for (i = 0; i < n; i++) {
+      DRSBoard::TimeData::FrequencyData * freq = init->fFrequency[i];
+      memcpy(p, &freq->fFrequency, sizeof(int));
+      p += sizeof(int);
+      memcpy(p, &freq->fModified, sizeof(long long));
+      p += sizeof(long long);
+      memcpy(p, &freq->fSize, sizeof(long long));
+      p += sizeof(long long);
+      memcpy(p, freq->fBin, kNumberOfBins * sizeof(double));
+      p += kNumberOfBins * sizeof(double);
+   }
+   header[0] = TIME_CACHE_VERSION;
+   header[1] = n;
+   header[2] = CalibrationChecksum(buffer, size);
+
+   GetTimeCalibrationCacheName(init->fChip, name, sizeof(name));
+   snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+   FILE *f = fopen(tmp, "wb");
+   if (f != NULL) {
+      bool ok = fwrite(TIME_CACHE_MAGIC, 1, 4, f) == 4 && fwrite(header, sizeof(header), 1, f) == 1 &&
+                fwrite(buffer, 1, size, f) == size;
+      ok = (fclose(f) == 0) && ok;
+      if (ok)
+         rename(tmp, name);
+      else
+         remove(tmp);
+   }
+   free(buffer);
+}
+
+/*------------------------------------------------------------------*/
+
+DRSBoard::TimeData * DRSBoard::GetTimeCalibration(unsigned int chipIndex, bool reinit)
+{
+   int i, index;
+
    index = fNumberOfTimeData;
    for (i = 0; i < fNumberOfTimeData; i++) {
       if (fTimeData[i]->fChip == static_cast < int >(chipIndex)) {
          if (!reinit)
             return fTimeData[i];
          else {
+            delete fTimeData[i];
             index = i;
             break;
          }
@@ -4720,27 +5130,14 @@ DRSBoard::TimeData * DRSBoard::GetTimeCalibration(unsigned int chipIndex, bool r
 
    init->fChip = chipIndex;
 
-   for (i = 0; i < init->kMaxNumberOfFrequencies; i++) {
-      if (i <= 499 || (i >= 501 && i <= 999) || (i >= 1001 && i <= 1499) || (i >= 1501 && i <= 1999) || 
-          (i >= 2001 && i <= 2499) || i >= 2501)
-         continue;
-      sprintf(fileName, "%s/board%d/TimeCalib_board%d_chip%d_%dMHz.xml", fCalibDirectory, fBoardSerialNumber,
-              fBoardSerialNumber, chipIndex, i);
-      rootNode = mxml_parse_file(fileName, error, sizeof(error), NULL);
-      if (rootNode == NULL)
-         continue;
-
-      init->fFrequency[init->fNumberOfFrequencies] = new DRSBoard::TimeData::FrequencyData();
-      init->fFrequency[init->fNumberOfFrequencies]->fFrequency = i;
-
-      mainNode = mxml_find_node(rootNode, "/DRSTimeCalibration");
-
-      for (l = 0; l < kNumberOfBins; l++) {
-         node = mxml_subnode(mainNode, l + 2);
-         init->fFrequency[init->fNumberOfFrequencies]->fBin[l] = strtod(mxml_get_value(node), &cstop);
-      }
-      mxml_free_tree(rootNode);
-      init->fNumberOfFrequencies++;
+   /* the XML files present decide, the cache spares parsing them */
+   ScanTimeCalibration(init);
+   if (init->fNumberOfFrequencies > 0 && !ReadTimeCalibrationCache(init)) {
+      for (i = 0; i < init->fNumberOfFrequencies; i++)
+         if (!ReadTimeCalibrationXML(chipIndex, init->fFrequency[i]->fFrequency, init->fFrequency[i]->fBin))
+            init->Remove(i--);
+      if (init->fNumberOfFrequencies > 0)
+         WriteTimeCalibrationCache(init);
    }
    if (init->fNumberOfFrequencies == 0) {
       printf("Board %d --> Could not find time calibration file\n", GetBoardSerialNumber());
@@ -4815,42 +5212,217 @@ void DRSBoard::ReadSingleWaveform(int nChip, int nChan,
    }
 }
       
-static unsigned short swf[kNumberOfChipsMax][kNumberOfChannelsMax][kNumberOfBins];
+typedef unsigned short drs_wave_t[kNumberOfChipsMax][kNumberOfChannelsMax][kNumberOfBins];
+typedef void (*drs_accumulate_t)(void *arg, int event, drs_wave_t &wf);
+
+/* event i is accumulated on a worker thread while event i+1 is read out,
+   events are accumulated one after the other in readout order */
+class WaveformPipe {
+   drs_wave_t       *fWave;         // two slots
+   drs_accumulate_t  fFunc;
+   void             *fArg;
+   int               fNRead;
+   int               fNDone;
+#ifndef _MSC_VER
+   bool              fThreaded;
+   bool              fQuit;
+   pthread_t         fThread;
+   pthread_mutex_t   fMutex;
+   pthread_cond_t    fCond;
+
+   static void      *Worker(void *arg);
+#endif
+
+   WaveformPipe(const WaveformPipe &c);              // not implemented
+   WaveformPipe &operator=(const WaveformPipe &rhs); // not implemented
+
+public:
+   WaveformPipe(drs_wave_t *wave, drs_accumulate_t func, void *arg);
+   ~WaveformPipe();
+
+   // slot for the next event, waits until its previous event is accumulated
+   drs_wave_t &Next();
+   void Push();
+   // wait until all events are accumulated
+   void Finish();
+};
+
+WaveformPipe::WaveformPipe(drs_wave_t *wave, drs_accumulate_t func, void *arg)
+{
+   fWave = wave;
+   fFunc = func;
+   fArg = arg;
+   fNRead = fNDone = 0;
+#ifndef _MSC_VER
+   fQuit = false;
+   pthread_mutex_init(&fMutex, NULL);
+   pthread_cond_init(&fCond, NULL);
+   fThreaded = pthread_create(&fThread, NULL, Worker, this) == 0;
+#endif
+}
+
+WaveformPipe::~WaveformPipe()
+{
+#ifndef _MSC_VER
+   if (fThreaded) {
+      pthread_mutex_lock(&fMutex);
+      fQuit = true;
+      pthread_cond_broadcast(&fCond);
+      pthread_mutex_unlock(&fMutex);
+      pthread_join(fThread, NULL);
+   }
+   pthread_cond_destroy(&fCond);
+   pthread_mutex_destroy(&fMutex);
+#endif
+}
+
+#ifndef _MSC_VER
+void *WaveformPipe::Worker(void *arg)
+{
+   WaveformPipe *pipe = (WaveformPipe *)arg;
+   int event;
+
+   pthread_mutex_lock(&pipe->fMutex);
+   for (;;) {
+      while (!pipe->fQuit && pipe->fNDone == pipe->fNRead)
+         pthread_cond_wait(&pipe->fCond, &pipe->fMutex);
+      if (pipe->fNDone == pipe->fNRead)
+         break;
+      event = pipe->fNDone;
+      pthread_mutex_unlock(&pipe->fMutex);
+
+      pipe->fFunc(pipe->fArg, event, pipe->fWave[event % 2]);
+
+      pthread_mutex_lock(&pipe->fMutex);
+      pipe->fNDone++;
+      pthread_cond_broadcast(&pipe->fCond);
+   }
+   pthread_mutex_unlock(&pipe->fMutex);
+   return NULL;
+}
+#endif
+
+drs_wave_t &WaveformPipe::Next()
+{
+#ifndef _MSC_VER
+   if (fThreaded) {
+      pthread_mutex_lock(&fMutex);
+      while (fNDone < fNRead - 1)
+         pthread_cond_wait(&fCond, &fMutex);
+      pthread_mutex_unlock(&fMutex);
+   }
+#endif
+   return fWave[fNRead % 2];
+}
+
+void WaveformPipe::Push()
+{
+#ifndef _MSC_VER
+   if (fThreaded) {
+      pthread_mutex_lock(&fMutex);
+      fNRead++;
+      pthread_cond_broadcast(&fCond);
+      pthread_mutex_unlock(&fMutex);
+      return;
+   }
+#endif
+   fFunc(fArg, fNRead, fWave[fNRead % 2]);
+   fNRead++;
+   fNDone++;
+}
+
+void WaveformPipe::Finish()
+{
+#ifndef _MSC_VER
+   if (fThreaded) {
+      pthread_mutex_lock(&fMutex);
+      while (fNDone < fNRead)
+         pthread_cond_wait(&fCond, &fMutex);
+      pthread_mutex_unlock(&fMutex);
+   }
+#endif
+}
+
+/*------------------------------------------------------------------*/
+
+static drs_wave_t     swf[2];
 static float          center[kNumberOfChipsMax][kNumberOfChannelsMax][kNumberOfBins];
 
+typedef struct {
+   int nChip;
+   int nChan;
+   Averager *ave;
+} drs_average_t;
+
+static void AccumulateCenter(void *arg, int event, drs_wave_t &wf)
+{
+   drs_average_t *a = (drs_average_t *)arg;
+   int j, k, l, sum;
+   float cm, v[kNumberOfBins];
+
+   /* skip the first events */
+   if (event <= 5)
+      return;
+
+   for (j=0 ; j<a->nChip ; j++) {
+      for (k=0 ; k<a->nChan ; k++) {
+         const unsigned short * __restrict w = wf[j][k];
+         float * __restrict c = center[j][k];
+
+         /* calculate and subtract common mode, the integer sum is exact and
+            equal to the float sum for waveforms near the mid scale */
+         for (l=0,sum=0 ; l<kNumberOfBins ; l++) {
+            sum += w[l];
+            v[l] = w[l];
+         }
+         cm = (float)(sum - 32768 * kNumberOfBins);
+         cm /= kNumberOfBins;
+         for (l=0 ; l<kNumberOfBins ; l++)
+            c[l] += v[l] - cm;
+      }
+   }
+}
+
+static void AccumulateRobust(void *arg, int event, drs_wave_t &wf)
+{
+   drs_average_t *a = (drs_average_t *)arg;
+   int j, k, l;
+
+   for (j=0 ; j<a->nChip ; j++)
+      for (k=0 ; k<a->nChan ; k++)
+         for (l=0 ; l<kNumberOfBins ; l++)
+            a->ave->Add(j, k, l, wf[j][k][l]);
+}
+
 int DRSBoard::AverageWaveforms(DRSCallback *pcb, int nChip, int nChan, 
                                int prog1, int prog2, unsigned short *awf, int n, bool rotated)
 {
-   int i, j, k, l, prog, old_prog = 0;
-   float cm;
+   int i, j, k, prog, old_prog = 0;
+   drs_average_t a;
 
    if (pcb != NULL)
       pcb->Progress(prog1);
 
    memset(center, 0, sizeof(center));
-
-   for (i=0 ; i<n; i++) {
-      ReadSingleWaveform(nChip, nChan, swf, rotated);
-
-      for (j=0 ; j<nChip ; j++) {
-         for (k=0 ; k<nChan ; k++) {
-            if (i > 5) {
-               /* calculate and subtract common mode */
-               for (l=0,cm=0 ; l<kNumberOfBins ; l++)
-                  cm += swf[j][k][l] - 32768;
-               cm /= kNumberOfBins;
-               for (l=0 ; l<kNumberOfBins ; l++)
-                  center[j][k][l] += swf[j][k][l]- cm;
-            }
+   a.nChip = nChip;
+   a.nChan = nChan;
+   a.ave = NULL;
+
+   {
+      WaveformPipe pipe(swf, AccumulateCenter, &a);
+
+      for (i=0 ; i<n; i++) {
+         ReadSingleWaveform(nChip, nChan, pipe.Next(), rotated);
+         pipe.Push();
+
+         prog = (int)(((double)i/n)*(prog2-prog1)+prog1);
+         if (prog > old_prog) {
+            old_prog = prog;
+            if (pcb != NULL)
+               pcb->Progress(prog);
          }
       }
-
-      prog = (int)(((double)i/n)*(prog2-prog1)+prog1);
-      if (prog > old_prog) {
-         old_prog = prog;
-         if (pcb != NULL)
-            pcb->Progress(prog);
-      }
+      pipe.Finish();
    }
 
    for (i=0 ; i<nChip ; i++)
@@ -4864,28 +5436,34 @@ int DRSBoard::AverageWaveforms(DRSCallback *pcb, int nChip, int nChan,
 int DRSBoard::RobustAverageWaveforms(DRSCallback *pcb, int nChip, int nChan, 
                                int prog1, int prog2, unsigned short *awf, int n, bool rotated)
 {
-   int i, j, k, l, prog, old_prog = 0;
+   int i, j, k, prog, old_prog = 0;
+   drs_average_t a;
 
    if (pcb != NULL)
       pcb->Progress(prog1);
 
    Averager *ave = new Averager(nChip, nChan, kNumberOfBins, 200);
+   a.nChip = nChip;
+   a.nChan = nChan;
+   a.ave = ave;
                                 
    /* fill histograms */
-   for (i=0 ; i<n ; i++) {
-      ReadSingleWaveform(nChip, nChan, swf, rotated);
-      for (j=0 ; j<nChip ; j++)
-         for (k=0 ; k<nChan ; k++)
-            for (l=0 ; l<kNumberOfBins ; l++)
-               ave->Add(j, k, l, swf[j][k][l]);
-               
-      /* update progress bar */
-      prog = (int)(((double)(i+10)/(n+10))*(prog2-prog1)+prog1);
-      if (prog > old_prog) {
-         old_prog = prog;
-         if (pcb != NULL)
-            pcb->Progress(prog);
+   {
+      WaveformPipe pipe(swf, AccumulateRobust, &a);
+
+      for (i=0 ; i<n ; i++) {
+         ReadSingleWaveform(nChip, nChan, pipe.Next(), rotated);
+         pipe.Push();
+
+         /* update progress bar */
+         prog = (int)(((double)(i+10)/(n+10))*(prog2-prog1)+prog1);
+         if (prog > old_prog) {
+            old_prog = prog;
+            if (pcb != NULL)
+               pcb->Progress(prog);
+         }
       }
+      pipe.Finish();
    }
 
    /*
@@ -5498,13 +6076,222 @@ double damping, zeroLevel, tPeriod, corr, dv, dv_limit, corr_limit;
 
 /*------------------------------------------------------------------*/
 
+/* worker threads for CalibrateTiming(), each job is one waveform of one channel */
+class TimingPool {
+   DRSBoard      *fBoard;
+   Averager      *fAve;
+   DRSTimingJob  *fJob;
+   int            fNJobs;
+   int            fNext;
+   int            fNDone;
+   int            fNThreads;
+#ifndef _MSC_VER
+   bool           fQuit;
+   pthread_t      fThread[4];
+   pthread_mutex_t fMutex;
+   pthread_cond_t fWork;
+   pthread_cond_t fDone;
+
+   static void   *Worker(void *arg);
+#endif
+
+   TimingPool(const TimingPool &c);              // not implemented
+   TimingPool &operator=(const TimingPool &rhs); // not implemented
+
+   void Analyze(DRSTimingJob *job);
+
+public:
+   TimingPool(DRSBoard *board, Averager *ave, int nThreads);
+   ~TimingPool();
+
+   // start the analysis of n jobs and return
+   void Run(DRSTimingJob *job, int n);
+   void Wait();
+};
+
+TimingPool::TimingPool(DRSBoard *board, Averager *ave, int nThreads)
+{
+   fBoard = board;
+   fAve = ave;
+   fJob = NULL;
+   fNJobs = fNext = fNDone = 0;
+   fNThreads = 0;
+#ifndef _MSC_VER
+   int i;
+   long nCpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+   /* one thread still overlaps the analysis with the readout */
+   if (nThreads > nCpu)
+      nThreads = nCpu > 1 ? (int)nCpu : 1;
+   if (nThreads > 4)
+      nThreads = 4;
+   fQuit = false;
+   pthread_mutex_init(&fMutex, NULL);
+   pthread_cond_init(&fWork, NULL);
+   pthread_cond_init(&fDone, NULL);
+   for (i=0 ; i<nThreads ; i++)
+      if (pthread_create(&fThread[fNThreads], NULL, Worker, this) == 0)
+         fNThreads++;
+#else
+   (void)nThreads;
+#endif
+}
+
+TimingPool::~TimingPool()
+{
+#ifndef _MSC_VER
+   int i;
+
+   pthread_mutex_lock(&fMutex);
+   fQuit = true;
+   pthread_cond_broadcast(&fWork);
+   pthread_mutex_unlock(&fMutex);
+   for (i=0 ; i<fNThreads ; i++)
+      pthread_join(fThread[i], NULL);
+   pthread_cond_destroy(&fDone);
+   pthread_cond_destroy(&fWork);
+   pthread_mutex_destroy(&fMutex);
+#endif
+}
+
+void TimingPool::Analyze(DRSTimingJob *job)
+{
+   if (job->slope)
+      job->status = fBoard->AnalyzeSlope(fAve, job->iter, job->nIter, job->channel, job->wf, job->tCell,
+                                         job->cellDV, job->dt);
+   else
+      job->status = fBoard->AnalyzePeriod(fAve, job->iter, job->nIter, job->channel, job->wf, job->tCell,
+                                          job->cellDV, job->dt);
+}
+
+#ifndef _MSC_VER
+void *TimingPool::Worker(void *arg)
+{
+   TimingPool *pool = (TimingPool *)arg;
+   DRSTimingJob *job;
+
+   pthread_mutex_lock(&pool->fMutex);
+   for (;;) {
+      while (!pool->fQuit && pool->fNext == pool->fNJobs)
+         pthread_cond_wait(&pool->fWork, &pool->fMutex);
+      if (pool->fQuit)
+         break;
+      job = &pool->fJob[pool->fNext++];
+      pthread_mutex_unlock(&pool->fMutex);
+
+      pool->Analyze(job);
+
+      pthread_mutex_lock(&pool->fMutex);
+      if (++pool->fNDone == pool->fNJobs)
+         pthread_cond_signal(&pool->fDone);
+   }
+   pthread_mutex_unlock(&pool->fMutex);
+   return NULL;
+}
+#endif
+
+void TimingPool::Run(DRSTimingJob *job, int n)
+{
+   int i;
+
+   if (fNThreads == 0) {
+      for (i=0 ; i<n ; i++)
+         Analyze(&job[i]);
+      fNJobs = fNext = fNDone = n;
+      return;
+   }
+#ifndef _MSC_VER
+   pthread_mutex_lock(&fMutex);
+   fJob = job;
+   fNJobs = n;
+   fNext = fNDone = 0;
+   pthread_cond_broadcast(&fWork);
+   pthread_mutex_unlock(&fMutex);
+#endif
+}
+
+void TimingPool::Wait()
+{
+#ifndef _MSC_VER
+   if (fNThreads == 0)
+      return;
+   pthread_mutex_lock(&fMutex);
+   while (fNDone < fNJobs)
+      pthread_cond_wait(&fDone, &fMutex);
+   pthread_mutex_unlock(&fMutex);
+#endif
+}
+
+/*------------------------------------------------------------------*/
+
+static void SetTimingJob(DRSTimingJob *job, int iter, int nIter, bool slope, int channel,
+                         double *cellDV, double *cellDT)
+{
+   job->iter = iter;
+   job->nIter = nIter;
+   job->slope = slope;
+   job->channel = channel;
+   job->cellDV = cellDV;
+   job->cellDT = cellDT;
+}
+
+/*------------------------------------------------------------------*/
+
+int DRSBoard::CommitTiming(DRSTimingJob *job, int n, int nIterPeriod, int *nError, int *error)
+{
+   int i, status;
+
+   /* same error handling as the serial analysis, returns 1 to skip the rest
+      of the iteration and 2 to stop the calibration */
+   for (i=0,status=1 ; i<n ; i++) {
+      memcpy(job[i].cellDT, job[i].dt, sizeof(job[i].dt));
+      status = job[i].status;
+
+      if (fTransport == TR_VME) {
+         if (!status)
+            (*nError)++;
+         if (*nError > nIterPeriod / 10) {
+            *error = 1;
+            return 0;
+         }
+      } else if (fBoardType == 5 || fBoardType == 7 || fBoardType == 8) {
+         if (!status)
+            (*nError)++;
+         if (*nError > nIterPeriod / 10) {
+            *error = 1;
+            return 2;
+         }
+      } else if (fBoardType == 9) {
+         if (!status)
+            (*nError)++;
+         if (*nError > nIterPeriod / 2) {
+            *error = 1;
+            break;
+         }
+      } else {
+         if (!status) {
+            *error = 1;
+            return 1;
+         }
+      }
+   }
+
+   if (fTransport != TR_VME && fBoardType == 9 && !status)
+      return 2;
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
 
 int DRSBoard::CalibrateTiming(DRSCallback *pcb)
 {
-   int    index, status, error, tCell, i, j, c, chip, mode, nIterPeriod, nIterSlope, clkon, phase, refclk, trg1, trg2, n_error, channel;
+   int    index, error, i, j, c, chip, mode, nMode, nIterPeriod, nIterSlope, clkon, phase, refclk, trg1, trg2, n_error, channel;
+   int    n, cur, prev, nJobs[2];
+   bool   ahead, stop;
    double f, range, tTrue, tRounded, dT, t1[8], t2[8], cellDV[kNumberOfChipsMax*kNumberOfChannelsMax][kNumberOfBins];
    unsigned short buf[1024*16]; // 32 kB
-   float  wf[1024];
+   DRSTimingJob jobs[2][4], *job;
    Averager *ave = NULL;
    
    nIterPeriod = 5000;
@@ -5558,91 +6345,76 @@ int DRSBoard::CalibrateTiming(DRSCallback *pcb)
          }
 
    error = 0;
-   
-   for (index = 0 ; index < nIterSlope+nIterPeriod ; index++) {
+   stop = false;
+
+   /* waveforms are captured here while the pool analyzes the previous ones, the
+      results are committed in capture order so they do not depend on the number
+      of threads; the mezzanine decides on its second mode from the first one and
+      is not captured ahead */
+   ahead = fTransport == TR_VME || fBoardType == 5 || fBoardType == 7 || fBoardType == 8 || fBoardType == 9;
+   nMode = ahead ? 1 : 2;
+   TimingPool pool(this, ave, fTransport == TR_VME || fBoardType == 9 ? 4 : ahead ? 1 : 2);
+   prev = -1;
+   cur = 0;
+
+   for (index = 0 ; index < nIterSlope+nIterPeriod && !stop ; index++) {
       if (index % 10 == 0)
          if (pcb)
             pcb->Progress(100*index/(nIterSlope+nIterPeriod));
 
-      if (fTransport == TR_VME) {
-         SoftTrigger();
-         while (IsBusy());
-
-         /* select random phase */
-         phase = (rand() % 30) - 15;
-         if (phase == 0)
-            phase = 15;
-         EnableTcal(1, 0, phase);
-
-         StartDomino();
-         TransferWaves();
-
-         for (chip=0 ; chip<4 ; chip++) {
-            tCell = GetStopCell(chip);
-            GetWave(chip, 8, wf, true, tCell, 0, true);
-            status = AnalyzePeriod(ave, index, nIterPeriod, 0, wf, tCell, cellDV[chip], fCellDT[chip][0]);
-
-            if (!status)
-               n_error++;
+      for (mode=0 ; mode<nMode ; mode++) {
+         job = jobs[cur];
+         n = 0;
 
-            if (n_error > nIterPeriod / 10) {
-               error = 1;
-               break;
-            }
-         }
-      } else {
-         if (fBoardType == 5 || fBoardType == 7 || fBoardType == 8) { // DRS4 Evaluation board: 1 Chip
+         if (fTransport == TR_VME) {
             SoftTrigger();
             while (IsBusy());
 
+            /* select random phase */
+            phase = (rand() % 30) - 15;
+            if (phase == 0)
+               phase = 15;
+            EnableTcal(1, 0, phase);
+
             StartDomino();
             TransferWaves();
 
-            tCell = GetStopCell(0);
-            GetWave(0, 8, wf, true, tCell, 0, true);
-            
-            if (index < nIterSlope)
-               status = AnalyzeSlope(ave, index, nIterSlope, 0, wf, tCell, cellDV[0], fCellDT[0][0]);
-            else
-               status = AnalyzePeriod(ave, index, nIterPeriod, 0, wf, tCell, cellDV[0], fCellDT[0][0]);
+            for (chip=0 ; chip<4 ; chip++, n++) {
+               job[n].tCell = GetStopCell(chip);
+               GetWave(chip, 8, job[n].wf, true, job[n].tCell, 0, true);
+               SetTimingJob(&job[n], index, nIterPeriod, false, 0, cellDV[chip], fCellDT[chip][0]);
+            }
+         } else {
+            if (fBoardType == 5 || fBoardType == 7 || fBoardType == 8) { // DRS4 Evaluation board: 1 Chip
+               SoftTrigger();
+               while (IsBusy());
 
-            if (!status)
-               n_error++;
+               StartDomino();
+               TransferWaves();
 
-            if (n_error > nIterPeriod / 10) {
-               error = 1;
-               break;
-            }
-         } else if (fBoardType == 9) { // DRS4 Evaluation board V5: all channels from one chip
-            SoftTrigger();
-            while (IsBusy());
-            
-            StartDomino();
-            TransferWaves();
-            
-            // calibrate all channels individually
-            for (channel = 0 ; channel < 8 ; channel+=2) {
-               tCell = GetStopCell(0);
-               GetWave(0, channel, wf, true, tCell, 0, true);
-               
+               job[n].tCell = GetStopCell(0);
+               GetWave(0, 8, job[n].wf, true, job[n].tCell, 0, true);
                if (index < nIterSlope)
-                  status = AnalyzeSlope(ave, index, nIterSlope, channel, wf, tCell, cellDV[channel], fCellDT[0][channel]);
+                  SetTimingJob(&job[n++], index, nIterSlope, true, 0, cellDV[0], fCellDT[0][0]);
                else
-                  status = AnalyzePeriod(ave, index, nIterPeriod, channel, wf, tCell, cellDV[channel], fCellDT[0][channel]);
-               
-               if (!status)
-                  n_error++;
-               
-               if (n_error > nIterPeriod / 2) {
-                  error = 1;
-                  break;
-               }
-            }
-            if (!status)
-               break;
+                  SetTimingJob(&job[n++], index, nIterPeriod, false, 0, cellDV[0], fCellDT[0][0]);
+            } else if (fBoardType == 9) { // DRS4 Evaluation board V5: all channels from one chip
+               SoftTrigger();
+               while (IsBusy());
+
+               StartDomino();
+               TransferWaves();
 
-         } else {               // DRS4 Mezzanine board: 4 Chips
-            for (mode=0 ; mode<2 ; mode++) {
+               // calibrate all channels individually
+               for (channel = 0 ; channel < 8 ; channel+=2, n++) {
+                  job[n].tCell = GetStopCell(0);
+                  GetWave(0, channel, job[n].wf, true, job[n].tCell, 0, true);
+                  if (index < nIterSlope)
+                     SetTimingJob(&job[n], index, nIterSlope, true, channel, cellDV[channel], fCellDT[0][channel]);
+                  else
+                     SetTimingJob(&job[n], index, nIterPeriod, false, channel, cellDV[channel], fCellDT[0][channel]);
+               }
+            } else {            // DRS4 Mezzanine board: 4 Chips
                SetChannelConfig(mode*2, 8, 8);
                SoftTrigger();
                while (IsBusy());
@@ -5656,24 +6428,46 @@ int DRSBoard::CalibrateTiming(DRSCallback *pcb)
                StartDomino();
                TransferWaves();
 
-               for (chip=0 ; chip<4 ; chip+=2) {
-                  tCell = GetStopCell(chip+mode);
-                  GetWave(chip+mode, 8, wf, true, tCell, 0, true);
-                  status = AnalyzePeriod(ave, index, nIterPeriod, 0, wf, tCell, cellDV[chip+mode], fCellDT[chip+mode][0]);
-
-                  if (!status) {
-                     error = 1;
-                     break;
-                  }
+               for (chip=0 ; chip<4 ; chip+=2, n++) {
+                  job[n].tCell = GetStopCell(chip+mode);
+                  GetWave(chip+mode, 8, job[n].wf, true, job[n].tCell, 0, true);
+                  SetTimingJob(&job[n], index, nIterPeriod, false, 0, cellDV[chip+mode], fCellDT[chip+mode][0]);
                }
-               if (!status)
-                  break;
+            }
+         }
 
+         /* previous waveforms must be committed before their cells are copied again */
+         if (prev >= 0) {
+            pool.Wait();
+            if (CommitTiming(jobs[prev], nJobs[prev], nIterPeriod, &n_error, &error) == 2) {
+               stop = true;
+               prev = -1;
+               break;
             }
+            prev = -1;
+         }
+
+         for (i=0 ; i<n ; i++)
+            memcpy(job[i].dt, job[i].cellDT, sizeof(job[i].dt));
+         nJobs[cur] = n;
+         pool.Run(job, n);
+
+         if (ahead) {
+            prev = cur;
+            cur = 1 - cur;
+         } else {
+            pool.Wait();
+            if (CommitTiming(job, n, nIterPeriod, &n_error, &error))
+               break;
          }
       }
    }
 
+   if (prev >= 0) {
+      pool.Wait();
+      CommitTiming(jobs[prev], nJobs[prev], nIterPeriod, &n_error, &error);
+   }
+
    if (pcb)
       pcb->Progress(100);
    
@@ -14,6 +14,7 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <algorithm>
 
 #include "averager.h"
 
@@ -25,15 +26,40 @@ Averager::Averager(int nx, int ny, int nz, int dim)
    fNy = ny;
    fNz = nz;
    fDim = dim;
+   fHisto = false;
+   fMin = fMax = fBinWidth = 0;
+   fHist = NULL;
    
    int size = sizeof(float)*nx*ny*nz * dim;
    fArray = (float *)malloc(size);
    assert(fArray);
    memset(fArray, 0, size);
-   size = sizeof(float)*nx*ny*nz;
+   size = sizeof(unsigned short)*nx*ny*nz;
    fN = (unsigned short *)malloc(size);
    assert(fN);
    memset(fN, 0, size);
+   fSorted = (unsigned char *)calloc(nx*ny*nz, 1);
+   assert(fSorted);
+}
+
+/*----------------------------------------------------------------*/
+
+Averager::Averager(int nx, int ny, int nz, int nBins, float min, float max)
+{
+   fNx = nx;
+   fNy = ny;
+   fNz = nz;
+   fDim = nBins;
+   fHisto = true;
+   fMin = min;
+   fMax = max;
+   fBinWidth = (max - min) / nBins;
+   fArray = NULL;
+   fN = NULL;
+   fSorted = NULL;
+
+   fHist = (unsigned int *)calloc(nx*ny*nz * (nBins + 2), sizeof(unsigned int));
+   assert(fHist);
 }
 
 /*----------------------------------------------------------------*/
@@ -44,8 +70,14 @@ Averager::~Averager()
       free(fN);
    if (fArray)
       free(fArray);
+   if (fSorted)
+      free(fSorted);
+   if (fHist)
+      free(fHist);
    fN = NULL;
    fArray = NULL;
+   fSorted = NULL;
+   fHist = NULL;
 }
 
 /*----------------------------------------------------------------*/
@@ -57,36 +89,92 @@ void Averager::Add(int x, int y, int z, float value)
    assert(z < fNz);
    
    int nIndex = (x*fNy + y)*fNz + z;
+
+   if (fHisto) {
+      int bin;
+      if (value < fMin)
+         bin = 0;
+      else if (value >= fMax)
+         bin = fDim + 1;
+      else {
+         bin = 1 + (int)((value - fMin) / fBinWidth);
+         if (bin > fDim)
+            bin = fDim;
+      }
+      fHist[nIndex * (fDim + 2) + bin]++;
+      return;
+   }
+
    if (fN[nIndex] == fDim - 1) // check if array full
       return;
    
    int aIndex = ((x*fNy + y)*fNz + z) * fDim + fN[nIndex];
    fN[nIndex]++;
    fArray[aIndex] = value;
+   fSorted[nIndex] = 0;
 }
 
 /*----------------------------------------------------------------*/
 
 void Averager::Reset()
 {
+   if (fHisto) {
+      memset(fHist, 0, sizeof(unsigned int)*fNx*fNy*fNz * (fDim + 2));
+      return;
+   }
    int size = sizeof(float)*fNx*fNy*fNz * fDim;
    memset(fArray, 0, size);
-   size = sizeof(float)*fNx*fNy*fNz;
+   size = sizeof(unsigned short)*fNx*fNy*fNz;
    memset(fN, 0, size);
+   memset(fSorted, 0, fNx*fNy*fNz);
+}
+
+/*----------------------------------------------------------------*/
+
+void Averager::Sort(int nIndex)
+{
+   // the order is kept until the next Add(), so repeated calls are free
+   if (fSorted[nIndex] != 2) {
+      float *a = fArray + nIndex * fDim;
+      std::sort(a, a + fN[nIndex]);
+      fSorted[nIndex] = 2;
+   }
 }
 
 /*----------------------------------------------------------------*/
 
-int compar(const void *a, const void *b);
+double Averager::BinCenter(int bin)
+{
+   if (bin == 0)
+      return fMin;
+   if (bin > fDim)
+      return fMax;
+   return fMin + (bin - 0.5) * fBinWidth;
+}
+
+/*----------------------------------------------------------------*/
 
-int compar(const void *a, const void *b)
+double Averager::HistoMedian(int nIndex, unsigned int *n)
 {
-   if (*((float *)a) == *((float *)b))
+   unsigned int *h = fHist + nIndex * (fDim + 2);
+   unsigned int i, c;
+
+   for (i=0,*n=0 ; i<(unsigned int)fDim+2 ; i++)
+      *n += h[i];
+   if (*n == 0)
       return 0;
-   
-   return (*((float *)a) < *((float *)b)) ? -1 : 1;
+
+   // same element as the sample mode, index n/2 in sorted order
+   for (i=0,c=0 ; i<(unsigned int)fDim+2 ; i++) {
+      c += h[i];
+      if (c > *n / 2)
+         break;
+   }
+   return BinCenter(i);
 }
-           
+
+/*----------------------------------------------------------------*/
+
 double Averager::Average(int x, int y, int z)
 {
    assert(x < fNx);
@@ -96,6 +184,17 @@ double Averager::Average(int x, int y, int z)
    double a = 0;
    
    int nIndex = (x*fNy + y)*fNz + z;
+
+   if (fHisto) {
+      unsigned int n = 0;
+      unsigned int *h = fHist + nIndex * (fDim + 2);
+      for (int i=0 ; i<fDim+2 ; i++) {
+         a += BinCenter(i) * h[i];
+         n += h[i];
+      }
+      return n > 0 ? a / n : 0;
+   }
+
    int aIndex = ((x*fNy + y)*fNz + z) * fDim;
 
    for (int i=0 ; i<fN[nIndex] ; i++)
@@ -115,15 +214,20 @@ double Averager::Median(int x, int y, int z)
    assert(y < fNy);
    assert(z < fNz);
    
-   double m = 0;
-   
    int nIndex = (x*fNy + y)*fNz + z;
    int aIndex = ((x*fNy + y)*fNz + z) * fDim;
+
+   if (fHisto) {
+      unsigned int n;
+      return HistoMedian(nIndex, &n);
+   }
    
-   qsort(&fArray[aIndex], fN[nIndex], sizeof(float), compar);
-   m = fArray[aIndex + fN[nIndex]/2];
-   
-   return m;
+   // a selection is enough, unless the cell is sorted already
+   if (fSorted[nIndex] == 0) {
+      std::nth_element(fArray + aIndex, fArray + aIndex + fN[nIndex]/2, fArray + aIndex + fN[nIndex]);
+      fSorted[nIndex] = 1;
+   }
+   return fArray[aIndex + fN[nIndex]/2];
 }
 
 /*----------------------------------------------------------------*/
@@ -136,24 +240,36 @@ double Averager::RobustAverage(double range, int x, int y, int z)
    
    double ra = 0;
    int n = 0;
-   double m = Median(x, y, z);
-   
    int nIndex = (x*fNy + y)*fNz + z;
-   int aIndex = ((x*fNy + y)*fNz + z) * fDim;
-   
-   for (int i=0 ; i<fN[nIndex] ; i++) {
-      if (fArray[aIndex + i] > m - range && fArray[aIndex + i] < m + range) {
-         ra += fArray[aIndex + i];
-         n++;
+
+   if (fHisto) {
+      unsigned int nTotal;
+      unsigned int *h = fHist + nIndex * (fDim + 2);
+      double m = HistoMedian(nIndex, &nTotal);
+      for (int i=0 ; i<fDim+2 ; i++) {
+         double v = BinCenter(i);
+         if (h[i] && v > m - range && v < m + range) {
+            ra += v * h[i];
+            n += h[i];
+         }
       }
+      return n > 0 ? ra / n : 0;
+   }
+
+   // sorted, values inside the range are one block around the median
+   Sort(nIndex);
+   float *a = fArray + nIndex * fDim;
+   float *end = a + fN[nIndex];
+   double m = a[fN[nIndex]/2];
+   
+   for (float *p = std::upper_bound(a, end, m - range) ; p < end && *p < m + range ; p++) {
+      ra += *p;
+      n++;
    }
    
    if (n > 0)
       ra /= n;
 
-   //if (y == 0 && z == 7 && fN[nIndex] > 10)
-   //   printf("%d %lf %lf %lf\n", fN[nIndex], a, m, ra);
-   
    return ra;
 }
 
@@ -174,33 +290,56 @@ int Averager::SaveNormalizedDistribution(const char *filename, int x, float rang
          
          int nIndex = (x*fNy + y)*fNz + z;
          int aIndex = ((x*fNy + y)*fNz + z) * fDim;
+         unsigned int n;
+         double m;
+
+         if (fHisto)
+            m = HistoMedian(nIndex, &n);
+         else {
+            Sort(nIndex);
+            n = fN[nIndex];
+            m = fArray[aIndex + n/2];
+         }
          
-         if (fN[nIndex] > 1) {
+         if (n > 1) {
             fprintf(f, "%d,%d, %d, ", x, y, z);
             
             double s = 0;
             double s2 = 0;
             double min = 0;
             double max = 0;
-            int n = fN[nIndex];
-            double m = Median(x, y, z);
             
-            for (int i=0 ; i<n ; i++) {
-               double v = fArray[aIndex + i] - m;
-               s += v;
-               s2 += v*v;
-               if (v < min)
-                  min = v;
-               if (v > max)
-                  max = v;
+            if (fHisto) {
+               unsigned int *h = fHist + nIndex * (fDim + 2);
+               for (int i=0 ; i<fDim+2 ; i++) {
+                  if (h[i] == 0)
+                     continue;
+                  double v = BinCenter(i) - m;
+                  s += v * h[i];
+                  s2 += v*v * h[i];
+                  if (v < min)
+                     min = v;
+                  if (v > max)
+                     max = v;
+               }
+            } else {
+               for (unsigned int i=0 ; i<n ; i++) {
+                  double v = fArray[aIndex + i] - m;
+                  s += v;
+                  s2 += v*v;
+                  if (v < min)
+                     min = v;
+                  if (v > max)
+                     max = v;
+               }
             }
-            double sigma = sqrt((n * s2 - s * s) / (n * (n-1)));
+            double sigma = sqrt((n * s2 - s * s) / (n * (n-1.0)));
             double average = s / n;
             
             fprintf(f, "%3.1lf, %3.1lf, %3.1lf, %3.3lf, ", min, max, average, sigma);
             
-            if (min < -range || max > range) {
-               for (int i=0 ; i<n ; i++)
+            if (!fHisto && (min < -range || max > range)) {
+               for (unsigned int i=0 ; i<n ; i++)
                   fprintf(f, "%3.1lf,", fArray[aIndex + i] - m);
             }
             
@@ -211,4 +350,3 @@ int Averager::SaveNormalizedDistribution(const char *filename, int x, float rang
    fclose(f);
    return 1;
 }
-
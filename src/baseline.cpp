@@ -0,0 +1,125 @@
+/********************************************************************\
+
+Name:         baseline.cpp
+
+Contents:     Incremental baseline tracking, see baseline.h
+
+\********************************************************************/
+
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+
+#include "baseline.h"
+
+/*------------------------------------------------------------------*/
+
+BaselineTracker::BaselineTracker(float alpha, int nCells, float clip) {
+  fNCells = nCells;
+  fAlpha = alpha;
+  fClip = clip;
+  fMean = fVar = NULL;
+  fValid = NULL;
+  if (nCells > 0) {
+    fMean = (float *)calloc(nCells, sizeof(float));
+    fVar = (float *)calloc(nCells, sizeof(float));
+    fValid = (bool *)calloc(nCells, sizeof(bool));
+    assert(fMean && fVar && fValid);
+  }
+  fChannelMean = fChannelVar = 0;
+  fChannelValid = false;
+}
+
+BaselineTracker::~BaselineTracker() {
+  free(fMean);
+  free(fVar);
+  free(fValid);
+}
+
+float BaselineTracker::GetRms() const {
+  return sqrtf(fChannelVar);
+}
+
+float BaselineTracker::GetBaseline(int bin, int triggerCell) const {
+  if (fNCells == 0)
+    return fChannelMean;
+  int c = (bin + triggerCell) % fNCells;
+  return fValid[c] ? fMean[c] : fChannelMean;
+}
+
+/*------------------------------------------------------------------*/
+
+void BaselineTracker::Update(const float *wf, int first, int n, int triggerCell) {
+  double sum = 0, sum2 = 0;
+  int count = 0;
+
+  if (n < 2)
+    return;
+
+  if (!fChannelValid) {
+    // the first event starts the averages with its median and the
+    // MAD as sigma, a pulse in its window must not widen the clip limit
+    float *d = (float *)malloc(n * sizeof(float));
+    assert(d);
+    for (int j = 0; j < n; j++)
+      d[j] = wf[first + j];
+    std::nth_element(d, d + n / 2, d + n);
+    float median = d[n / 2];
+    for (int j = 0; j < n; j++)
+      d[j] = fabsf(d[j] - median);
+    std::nth_element(d, d + n / 2, d + n);
+    float sigma = 1.4826f * d[n / 2];
+    free(d);
+
+    // then the clipped mean and variance around it
+    for (int j = first; j < first + n; j++) {
+      float r = wf[j] - median;
+      if (sigma > 0 && fabsf(r) > fClip * sigma)
+        continue;
+      sum += r;
+      sum2 += r * r;
+      count++;
+    }
+    fChannelMean = median + sum / count;
+    fChannelVar = fabs(sum2 / count - (sum / count) * (sum / count));
+    fChannelValid = true;
+    sum = sum2 = 0;
+    count = 0;
+  }
+
+  float limit = fClip * sqrtf(fChannelVar);
+  for (int j = first; j < first + n; j++) {
+    float r = wf[j] - fChannelMean;
+    if (fabsf(r) > limit && limit > 0)
+      continue;
+    sum += r;
+    sum2 += r * r;
+    count++;
+
+    if (fNCells > 0) {
+      int c = (j + triggerCell) % fNCells;
+      if (!fValid[c]) {
+        fMean[c] = wf[j];
+        fVar[c] = fChannelVar;
+        fValid[c] = true;
+      } else {
+        float rc = wf[j] - fMean[c];
+        if (fabsf(rc) <= fClip * sqrtf(fVar[c]) || fVar[c] == 0) {
+          fMean[c] += fAlpha * rc;
+          fVar[c] += fAlpha * (rc * rc - fVar[c]);
+        }
+      }
+    }
+  }
+
+  // a window mostly outside the limits (pulse in the pre-trigger) is
+  // skipped, widening the limits so that a baseline step is followed
+  if (count < n / 2) {
+    fChannelVar += fAlpha * fChannelVar;
+    return;
+  }
+  float mean = sum / count;
+  fChannelMean += fAlpha * mean;
+  fChannelVar += fAlpha * (sum2 / count - mean * mean - fChannelVar);
+}
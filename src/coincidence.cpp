@@ -0,0 +1,97 @@
+/********************************************************************\
+
+Name:         coincidence.cpp
+
+Contents:     Software coincidences, see coincidence.h
+
+\********************************************************************/
+
+#include <string.h>
+
+#include "coincidence.h"
+
+/*------------------------------------------------------------------*/
+
+CoincidenceBuilder::CoincidenceBuilder(float window) {
+  fWindow = window;
+  fNPairs = 0;
+  Clear();
+}
+
+bool CoincidenceBuilder::AddPair(const coinc_pair_t &p) {
+  if (fNPairs == COINC_MAX_PAIRS || p.boardA < 0 || p.boardA >= COINC_MAX_BOARDS ||
+      p.boardB < 0 || p.boardB >= COINC_MAX_BOARDS || p.min > p.max)
+    return false;
+  fPair[fNPairs++] = p;
+  return true;
+}
+
+void CoincidenceBuilder::Clear() {
+  memset(fNHits, 0, sizeof(fNHits));
+  fNMerged = 0;
+}
+
+bool CoincidenceBuilder::AddHit(int board, int channel, float time, float amplitude) {
+  if (board < 0 || board >= COINC_MAX_BOARDS || fNHits[board] == COINC_MAX_HITS)
+    return false;
+
+  // insertion keeps the short board list sorted by time
+  hit_t *h = fHits[board];
+  int i = fNHits[board]++;
+  for (; i > 0 && h[i - 1].time > time; i--)
+    h[i] = h[i - 1];
+  h[i].time = time;
+  h[i].amplitude = amplitude;
+  h[i].board = board;
+  h[i].channel = channel;
+  return true;
+}
+
+/*------------------------------------------------------------------*/
+
+int CoincidenceBuilder::Build(float *dt, int *pairMask) {
+  int next[COINC_MAX_BOARDS] = {0};
+
+  // merge the sorted board lists
+  fNMerged = 0;
+  for (;;) {
+    int best = -1;
+    for (int b = 0; b < COINC_MAX_BOARDS; b++)
+      if (next[b] < fNHits[b] &&
+          (best < 0 || fHits[b][next[b]].time < fHits[best][next[best]].time))
+        best = b;
+    if (best < 0)
+      break;
+    fMerged[fNMerged++] = fHits[best][next[best]++];
+  }
+
+  // sliding window over the merged list
+  int multiplicity = 0;
+  for (int first = 0, last = 0; last < fNMerged; last++) {
+    while (fMerged[last].time - fMerged[first].time > fWindow)
+      first++;
+    if (last - first + 1 > multiplicity)
+      multiplicity = last - first + 1;
+  }
+
+  // pair differences from the earliest hit of each channel
+  *pairMask = 0;
+  for (int i = 0; i < fNPairs; i++) {
+    const coinc_pair_t &p = fPair[i];
+    const hit_t *a = NULL, *b = NULL;
+    for (int j = 0; j < fNMerged && (!a || !b); j++) {
+      if (!a && fMerged[j].board == p.boardA && fMerged[j].channel == p.channelA)
+        a = &fMerged[j];
+      else if (!b && fMerged[j].board == p.boardB && fMerged[j].channel == p.channelB)
+        b = &fMerged[j];
+    }
+    dt[i] = 0;
+    if (a && b) {
+      dt[i] = b->time - a->time;
+      if (dt[i] >= p.min && dt[i] <= p.max)
+        *pairMask |= 1 << i;
+    }
+  }
+
+  return multiplicity;
+}
@@ -0,0 +1,316 @@
+/********************************************************************\
+
+Name:         columnFile.cpp
+
+Contents:     Columnar chunked event files, see columnFile.h
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "columnFile.h"
+
+/*------------------------------------------------------------------*/
+
+ColumnWriter::ColumnWriter(int nBoards, int nBins, int chunkEvents) {
+  fFd = 0;
+  fNBoards = nBoards;
+  fNBins = nBins;
+  fChunkEvents = chunkEvents;
+  fNEvents = 0;
+  fSerial = (int *)malloc(sizeof(int) * chunkEvents);
+  fTime = (long long *)malloc(sizeof(long long) * chunkEvents);
+  fTriggerCell = (unsigned short *)malloc(sizeof(unsigned short) * nBoards * chunkEvents);
+  fExtrema = (unsigned short *)malloc(sizeof(unsigned short) * nBoards * 4 * 2 * chunkEvents);
+  fWaveform = (unsigned short *)malloc(sizeof(unsigned short) * nBoards * 4 * nBins * chunkEvents);
+  assert(fSerial && fTime && fTriggerCell && fExtrema && fWaveform);
+}
+
+ColumnWriter::~ColumnWriter() {
+  free(fSerial);
+  free(fTime);
+  free(fTriggerCell);
+  free(fExtrema);
+  free(fWaveform);
+}
+
+int ColumnWriter::Open(int fd, unsigned short range, const unsigned char *timeHeader, int size) {
+  column_file_header_t h;
+
+  fFd = fd;
+  fNEvents = 0;
+  memcpy(h.magic, "DRSC", 4);
+  h.version = 1;
+  h.nBoards = fNBoards;
+  h.nBins = fNBins;
+  h.range = range;
+  h.reserved = 0;
+  if (write(fd, &h, sizeof(h)) != (int)sizeof(h))
+    return -1;
+  if (write(fd, timeHeader, size) != size)
+    return -1;
+  return sizeof(h) + size;
+}
+
+int ColumnWriter::AddEvent(int serial, long long timeMs, const int *triggerCell, const unsigned short *adc) {
+  int n = fNEvents;
+
+  fSerial[n] = serial;
+  fTime[n] = timeMs;
+  for (int b = 0; b < fNBoards; b++)
+    fTriggerCell[b * fChunkEvents + n] = triggerCell[b];
+
+  // channel blocks are laid out column by column, event by event inside
+  for (int c = 0; c < fNBoards * 4; c++) {
+    const unsigned short *src = adc + c * fNBins;
+    unsigned short min = 0xFFFF, max = 0;
+    for (int j = 0; j < fNBins; j++) {
+      if (src[j] < min)
+        min = src[j];
+      if (src[j] > max)
+        max = src[j];
+    }
+    fExtrema[(c * 2) * fChunkEvents + n] = min;
+    fExtrema[(c * 2 + 1) * fChunkEvents + n] = max;
+    memcpy(fWaveform + ((long)c * fChunkEvents + n) * fNBins, src, fNBins * sizeof(unsigned short));
+  }
+
+  fNEvents++;
+  if (fNEvents == fChunkEvents)
+    return Flush();
+  return 0;
+}
+
+int ColumnWriter::Flush() {
+  int n = fNEvents;
+  int nColumns = 1 + fNBoards * 4 * 2;
+  column_info_t *info;
+  column_chunk_header_t h;
+  unsigned long long offset;
+
+  if (n == 0 || !fFd)
+    return 0;
+
+  info = (column_info_t *)calloc(nColumns, sizeof(column_info_t));
+  assert(info);
+
+  // header column
+  offset = sizeof(h);
+  info[0].kind = COLUMN_HEADER;
+  info[0].offset = offset;
+  info[0].size = n * (sizeof(int) + sizeof(long long) + fNBoards * sizeof(unsigned short));
+  info[0].min = fSerial[0];
+  info[0].max = fSerial[n - 1];
+  offset += info[0].size;
+
+  for (int c = 0; c < fNBoards * 4; c++) {
+    column_info_t *e = &info[1 + c];
+    column_info_t *w = &info[1 + fNBoards * 4 + c];
+    const unsigned short *min = fExtrema + (c * 2) * fChunkEvents;
+    const unsigned short *max = fExtrema + (c * 2 + 1) * fChunkEvents;
+
+    e->kind = COLUMN_EXTREMA;
+    w->kind = COLUMN_WAVEFORM;
+    e->board = w->board = c / 4;
+    e->channel = w->channel = c % 4;
+    e->min = w->min = 65535;
+    e->max = w->max = 0;
+    for (int i = 0; i < n; i++) {
+      if (min[i] < e->min)
+        e->min = w->min = min[i];
+      if (max[i] > e->max)
+        e->max = w->max = max[i];
+    }
+    e->size = n * 2 * sizeof(unsigned short);
+    w->size = (unsigned long long)n * fNBins * sizeof(unsigned short);
+  }
+
+  // extrema first, so cut scans touch one small block per channel
+  for (int i = 1; i < nColumns; i++) {
+    info[i].offset = offset;
+    offset += info[i].size;
+  }
+
+  memcpy(h.magic, "CHNK", 4);
+  h.nEvents = n;
+  h.nColumns = nColumns;
+  h.reserved = 0;
+  h.size = offset + nColumns * sizeof(column_info_t);
+
+  long total = 0;
+  int status = 0;
+  status |= write(fFd, &h, sizeof(h)) != (int)sizeof(h);
+  status |= write(fFd, fSerial, n * sizeof(int)) != (int)(n * sizeof(int));
+  status |= write(fFd, fTime, n * sizeof(long long)) != (int)(n * sizeof(long long));
+  for (int b = 0; b < fNBoards; b++)
+    status |= write(fFd, fTriggerCell + b * fChunkEvents, n * sizeof(unsigned short)) !=
+              (int)(n * sizeof(unsigned short));
+  for (int c = 0; c < fNBoards * 4; c++) {
+    status |= write(fFd, fExtrema + (c * 2) * fChunkEvents, n * sizeof(unsigned short)) !=
+              (int)(n * sizeof(unsigned short));
+    status |= write(fFd, fExtrema + (c * 2 + 1) * fChunkEvents, n * sizeof(unsigned short)) !=
+              (int)(n * sizeof(unsigned short));
+  }
+  for (int c = 0; c < fNBoards * 4; c++) {
+    long size = (long)n * fNBins * sizeof(unsigned short);
+    status |= write(fFd, fWaveform + (long)c * fChunkEvents * fNBins, size) != size;
+  }
+  status |= write(fFd, info, nColumns * sizeof(column_info_t)) !=
+            (int)(nColumns * sizeof(column_info_t));
+  total = h.size;
+
+  free(info);
+  fNEvents = 0;
+  return status ? -1 : total;
+}
+
+/*------------------------------------------------------------------*/
+
+ColumnReader::ColumnReader() {
+  fFile = NULL;
+  fInfo = NULL;
+  fTcal = NULL;
+  fChunkStart = 0;
+  memset(&fHeader, 0, sizeof(fHeader));
+  memset(&fChunk, 0, sizeof(fChunk));
+}
+
+ColumnReader::~ColumnReader() {
+  Close();
+}
+
+bool ColumnReader::Open(const char *filename) {
+  char tag[4];
+
+  Close();
+  fFile = fopen(filename, "rb");
+  if (!fFile)
+    return false;
+
+  if (fread(&fHeader, sizeof(fHeader), 1, fFile) != 1 || memcmp(fHeader.magic, "DRSC", 4) != 0) {
+    Close();
+    return false;
+  }
+
+  // time calibration block: "TIME", per board "B#" serial + 4 x ("C00x" + bins)
+  if (fread(tag, 1, 4, fFile) != 4 || memcmp(tag, "TIME", 4) != 0) {
+    Close();
+    return false;
+  }
+  fTcal = (float *)malloc(fHeader.nBoards * 4 * fHeader.nBins * sizeof(float));
+  for (unsigned int b = 0; b < fHeader.nBoards; b++) {
+    fseek(fFile, 4, SEEK_CUR);
+    for (int i = 0; i < 4; i++) {
+      fseek(fFile, 4, SEEK_CUR);
+      if (fread(fTcal + (b * 4 + i) * fHeader.nBins, sizeof(float), fHeader.nBins, fFile) != fHeader.nBins) {
+        Close();
+        return false;
+      }
+    }
+  }
+  fChunkStart = ftell(fFile);
+  fChunk.size = 0;
+  return true;
+}
+
+void ColumnReader::Close() {
+  if (fFile)
+    fclose(fFile);
+  fFile = NULL;
+  free(fInfo);
+  fInfo = NULL;
+  free(fTcal);
+  fTcal = NULL;
+}
+
+int ColumnReader::GetTimeCalibration(int b, int ch, float *tcal) const {
+  if (!fTcal || b >= (int)fHeader.nBoards)
+    return 0;
+  memcpy(tcal, fTcal + (b * 4 + ch) * fHeader.nBins, fHeader.nBins * sizeof(float));
+  return fHeader.nBins;
+}
+
+int ColumnReader::NextChunk() {
+  if (!fFile)
+    return 0;
+
+  fChunkStart += fChunk.size;
+  fseek(fFile, fChunkStart, SEEK_SET);
+  if (fread(&fChunk, sizeof(fChunk), 1, fFile) != 1 || memcmp(fChunk.magic, "CHNK", 4) != 0) {
+    fChunk.size = 0;
+    return 0;
+  }
+
+  free(fInfo);
+  fInfo = (column_info_t *)malloc(fChunk.nColumns * sizeof(column_info_t));
+  fseek(fFile, fChunkStart + fChunk.size - fChunk.nColumns * sizeof(column_info_t), SEEK_SET);
+  if (fread(fInfo, sizeof(column_info_t), fChunk.nColumns, fFile) != fChunk.nColumns) {
+    fChunk.size = 0;
+    return 0;
+  }
+  return fChunk.nEvents;
+}
+
+const column_info_t *ColumnReader::Find(int kind, int b, int ch) const {
+  for (unsigned int i = 0; fInfo && i < fChunk.nColumns; i++)
+    if (fInfo[i].kind == kind && (kind == COLUMN_HEADER ||
+                                  (fInfo[i].board == b && fInfo[i].channel == ch)))
+      return &fInfo[i];
+  return NULL;
+}
+
+int ColumnReader::ReadColumn(const column_info_t *c, void *buffer) {
+  if (!c)
+    return 0;
+  fseek(fFile, fChunkStart + c->offset, SEEK_SET);
+  return fread(buffer, 1, c->size, fFile) == c->size;
+}
+
+bool ColumnReader::GetRange(int b, int ch, float *min, float *max) const {
+  const column_info_t *c = Find(COLUMN_EXTREMA, b, ch);
+  if (!c)
+    return false;
+  *min = c->min;
+  *max = c->max;
+  return true;
+}
+
+int ColumnReader::ReadHeader(int *serial, long long *timeMs, unsigned short *triggerCell) {
+  const column_info_t *c = Find(COLUMN_HEADER, 0, 0);
+  int n = fChunk.nEvents;
+
+  if (!c)
+    return 0;
+  unsigned char *buffer = (unsigned char *)malloc(c->size);
+  if (!ReadColumn(c, buffer)) {
+    free(buffer);
+    return 0;
+  }
+  memcpy(serial, buffer, n * sizeof(int));
+  memcpy(timeMs, buffer + n * sizeof(int), n * sizeof(long long));
+  memcpy(triggerCell, buffer + n * (sizeof(int) + sizeof(long long)),
+         n * fHeader.nBoards * sizeof(unsigned short));
+  free(buffer);
+  return n;
+}
+
+int ColumnReader::ReadExtrema(int b, int ch, unsigned short *min, unsigned short *max) {
+  const column_info_t *c = Find(COLUMN_EXTREMA, b, ch);
+  int n = fChunk.nEvents;
+
+  if (!c)
+    return 0;
+  fseek(fFile, fChunkStart + c->offset, SEEK_SET);
+  if (fread(min, sizeof(unsigned short), n, fFile) != (size_t)n ||
+      fread(max, sizeof(unsigned short), n, fFile) != (size_t)n)
+    return 0;
+  return n;
+}
+
+int ColumnReader::ReadWaveforms(int b, int ch, unsigned short *adc) {
+  return ReadColumn(Find(COLUMN_WAVEFORM, b, ch), adc) ? fChunk.nEvents : 0;
+}
@@ -0,0 +1,108 @@
+/********************************************************************\
+
+Name:         control.cpp
+
+Contents:     Run control over a named pipe, see control.h
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#include "control.h"
+
+/*------------------------------------------------------------------*/
+
+ControlChannel::ControlChannel() {
+  fFd = 0;
+  fLength = 0;
+}
+
+ControlChannel::~ControlChannel() {
+  Close();
+}
+
+bool ControlChannel::Open(const char *path) {
+  struct stat st;
+
+  Close();
+  if (mkfifo(path, 0660) != 0 && errno != EEXIST)
+    return false;
+  if (stat(path, &st) != 0 || !S_ISFIFO(st.st_mode))
+    return false;
+  fFd = open(path, O_RDWR | O_NONBLOCK);
+  if (fFd < 0) {
+    fFd = 0;
+    return false;
+  }
+  return true;
+}
+
+void ControlChannel::Close() {
+  if (fFd)
+    close(fFd);
+  fFd = 0;
+  fLength = 0;
+}
+
+int ControlChannel::Read(int timeoutMs) {
+  struct pollfd p;
+
+  if (!fFd)
+    return 0;
+  p.fd = fFd;
+  p.events = POLLIN;
+  if (poll(&p, 1, timeoutMs) <= 0)
+    return 0;
+
+  // a full buffer without a newline is garbage, drop it
+  if (fLength == (int)sizeof(fBuffer))
+    fLength = 0;
+  int n = read(fFd, fBuffer + fLength, sizeof(fBuffer) - fLength);
+  if (n <= 0)
+    return 0;
+  fLength += n;
+  return n;
+}
+
+/*------------------------------------------------------------------*/
+
+bool ControlChannel::GetLine(char *line, int size) {
+  char *end = (char *)memchr(fBuffer, '\n', fLength);
+  if (!end)
+    return false;
+
+  int n = end - fBuffer;
+  int copy = n < size - 1 ? n : size - 1;
+  memcpy(line, fBuffer, copy);
+  line[copy] = 0;
+  if (copy > 0 && line[copy - 1] == '\r')
+    line[copy - 1] = 0;
+  fLength -= n + 1;
+  memmove(fBuffer, end + 1, fLength);
+  return true;
+}
+
+bool ControlChannel::Find(const char *command, bool remove) {
+  int len = strlen(command);
+  char *p = fBuffer;
+
+  for (char *end; (end = (char *)memchr(p, '\n', fBuffer + fLength - p)) != NULL; p = end + 1) {
+    int n = end - p;
+    if (n > 0 && p[n - 1] == '\r')
+      n--;
+    if (n != len || memcmp(p, command, len) != 0)
+      continue;
+    if (remove) {
+      fLength -= end + 1 - p;
+      memmove(p, end + 1, fBuffer + fLength - p);
+    }
+    return true;
+  }
+  return false;
+}
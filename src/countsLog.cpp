@@ -0,0 +1,163 @@
+/********************************************************************\
+
+Name:         countsLog.cpp
+
+Contents:     Binary per-event counts stream, see countsLog.h
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+
+#include "countsLog.h"
+
+/*------------------------------------------------------------------*/
+
+unsigned long long MonotonicNs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void PrintBinCounts(FILE *f, const counts_bin_t &bin) {
+  fprintf(f, "%d ", bin.total);
+  for (int c = 0; c < N_CLASSES; c++)
+    fprintf(f, "%d ", bin.count[classColumn[c]]);
+}
+
+/*------------------------------------------------------------------*/
+
+CountsWriter::CountsWriter(int bufferedRecords) {
+  fFd = 0;
+  fNRecords = 0;
+  fBytes = 0;
+  fSize = bufferedRecords;
+  fBuffer = (count_record_t *)malloc(sizeof(count_record_t) * fSize);
+  assert(fBuffer);
+}
+
+CountsWriter::~CountsWriter() {
+  Close();
+  free(fBuffer);
+}
+
+bool CountsWriter::Open(const char *filename, long long startWall) {
+  counts_header_t h;
+
+  Close();
+  fFd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fFd < 0) {
+    fFd = 0;
+    return false;
+  }
+
+  memcpy(h.magic, "DRSN", 4);
+  h.version = 5;
+  h.recordSize = sizeof(count_record_t);
+  h.reserved = 0;
+  h.startWall = startWall;
+  fBytes = 0;
+  if (write(fFd, &h, sizeof(h)) != (int)sizeof(h))
+    return false;
+  fBytes = sizeof(h);
+  return true;
+}
+
+void CountsWriter::Close() {
+  if (fFd) {
+    Flush();
+    close(fFd);
+  }
+  fFd = 0;
+}
+
+int CountsWriter::Flush() {
+  int size = fNRecords * sizeof(count_record_t);
+
+  fNRecords = 0;
+  if (!fFd || size == 0)
+    return 0;
+  if (write(fFd, fBuffer, size) != size)
+    return -1;
+  fBytes += size;
+  return size;
+}
+
+/*------------------------------------------------------------------*/
+
+CountsReader::CountsReader() {
+  fFile = NULL;
+  memset(&fHeader, 0, sizeof(fHeader));
+}
+
+CountsReader::~CountsReader() {
+  Close();
+}
+
+bool CountsReader::Open(const char *filename) {
+  Close();
+  fFile = fopen(filename, "rb");
+  if (!fFile)
+    return false;
+  if (fread(&fHeader, sizeof(fHeader), 1, fFile) != 1 || memcmp(fHeader.magic, "DRSN", 4) != 0 ||
+      fHeader.recordSize == 0) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void CountsReader::Close() {
+  if (fFile)
+    fclose(fFile);
+  fFile = NULL;
+}
+
+int CountsReader::Read(count_record_t *r) {
+  unsigned int n = fHeader.recordSize < sizeof(count_record_t) ? fHeader.recordSize : sizeof(count_record_t);
+
+  if (!fFile)
+    return 0;
+
+  // newer writers may append fields, older ones leave the tail zero
+  memset(r, 0, sizeof(count_record_t));
+  if (fread(r, 1, n, fFile) != n)
+    return 0;
+  if (fHeader.recordSize > n)
+    fseek(fFile, fHeader.recordSize - n, SEEK_CUR);
+  return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+CountsBinner::CountsBinner(double seconds) {
+  fWidth = (unsigned long long)(seconds * 1E9);
+  memset(&fBin, 0, sizeof(fBin));
+  fBin.end = fWidth;
+}
+
+int CountsBinner::Advance(unsigned long long t, void (*emit)(const counts_bin_t &bin, void *arg), void *arg) {
+  int n = 0;
+
+  while (t >= fBin.end) {
+    emit(fBin, arg);
+    fBin.start = fBin.end;
+    fBin.end += fWidth;
+    fBin.total = 0;
+    memset(fBin.count, 0, sizeof(fBin.count));
+    n++;
+  }
+  return n;
+}
+
+void CountsBinner::Add(int classification) {
+  fBin.total++;
+  if (classification >= 0 && classification < N_CLASSES)
+    fBin.count[classification]++;
+}
@@ -0,0 +1,63 @@
+/********************************************************************\
+
+Name:         drsCounts.cpp
+
+Contents:     Rebin the binary counts stream of drsLog (.cnt) and print
+              it in the format of the per-minute text file.
+
+              ./drsCounts <file.cnt> [<bin seconds>]
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "countsLog.h"
+
+long long startWall;
+
+void PrintBin(const counts_bin_t &bin, void *arg) {
+  time_t label = (time_t)((startWall + (long long)bin.end) / 1000000000LL);
+  PrintBinCounts(stdout, bin);
+  printf("%s", asctime(localtime(&label)));
+}
+
+int main(int argc, char** argv) {
+
+  if (argc != 2 && argc != 3) {
+    printf("Usage: %s <file.cnt> [<bin seconds> (60)]\n", argv[0]);
+    return 1;
+  }
+
+  double seconds = argc == 3 ? atof(argv[2]) : 60;
+  if (seconds <= 0) {
+    printf("Bin width, %s must be positive.\n", argv[2]);
+    return 1;
+  }
+
+  CountsReader reader;
+  if (!reader.Open(argv[1])) {
+    printf("Cannot open '%s'.\n", argv[1]);
+    return 1;
+  }
+  startWall = reader.GetHeader().startWall;
+
+  CountsBinner binner(seconds);
+  count_record_t r;
+  unsigned long long last = 0;
+
+  while (reader.Read(&r)) {
+    binner.Advance(r.time, PrintBin, NULL);
+    binner.Add(r.classification);
+    last = r.time;
+  }
+
+  // the last bin ends with the last event
+  if (binner.GetCurrent().total > 0) {
+    counts_bin_t bin = binner.GetCurrent();
+    bin.end = last;
+    PrintBin(bin, NULL);
+  }
+  return 0;
+}
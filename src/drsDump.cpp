@@ -0,0 +1,160 @@
+/********************************************************************\
+
+Name:         drsDump.cpp
+
+Contents:     Print the events of a drsLog binary file, or dump one
+              reconstructed channel as text for plotting. Columnar
+              files are listed chunk by chunk.
+
+              ./drsDump <file>                    one line per event
+              ./drsDump <file> <event> <channel>  time/voltage columns
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "drsReader.h"
+#include "columnFile.h"
+
+int DumpColumns(ColumnReader &reader, int dumpSerial, int dumpChannel) {
+  const column_file_header_t &fh = reader.GetFileHeader();
+  int n;
+  int nChunks = 0;
+  long nEvents = 0;
+
+  while ((n = reader.NextChunk()) > 0) {
+    const column_info_t *h = reader.GetColumnInfo(0);
+    nChunks++;
+    nEvents += n;
+
+    if (dumpChannel >= 0) {
+      // only the header column and one waveform column are read
+      if (dumpSerial < h->min || dumpSerial > h->max)
+        continue;
+      int *serial = new int[n];
+      long long *timeMs = new long long[n];
+      unsigned short *tc = new unsigned short[n * fh.nBoards];
+      unsigned short *adc = new unsigned short[n * fh.nBins];
+      float *tcal = new float[fh.nBins];
+      reader.ReadHeader(serial, timeMs, tc);
+      reader.ReadWaveforms(0, dumpChannel, adc);
+      int haveTime = reader.GetTimeCalibration(0, dumpChannel, tcal);
+      for (int e = 0; e < n; e++) {
+        if (serial[e] != dumpSerial)
+          continue;
+        float t = 0;
+        for (unsigned int j = 0; j < fh.nBins; j++) {
+          printf("%8.3f %8.3f\n", haveTime ? t : j,
+                 (adc[e * fh.nBins + j] / 65535.0 - 0.5) * 1000.0 + fh.range);
+          if (haveTime)
+            t += tcal[(j + tc[e]) % fh.nBins];
+        }
+      }
+      delete[] serial;
+      delete[] timeMs;
+      delete[] tc;
+      delete[] adc;
+      delete[] tcal;
+      return 0;
+    }
+
+    printf("chunk %4d  %6d events  serial %6.0f-%-6.0f", nChunks, n, h->min, h->max);
+    for (unsigned int b = 0; b < fh.nBoards; b++)
+      for (int i = 0; i < READER_N_CHANNELS; i++) {
+        float min, max;
+        if (reader.GetRange(b, i, &min, &max))
+          printf("  CH%d %6.1f..%6.1f mV", i + 1, (min / 65535.0 - 0.5) * 1000.0 + fh.range,
+                 (max / 65535.0 - 0.5) * 1000.0 + fh.range);
+      }
+    printf("\n");
+  }
+
+  if (dumpChannel >= 0) {
+    printf("Event %d not found.\n", dumpSerial);
+    return 1;
+  }
+  printf("%ld events in %d chunks\n", nEvents, nChunks);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+
+  if (argc != 2 && argc != 4) {
+    printf("Usage: %s <file> [<event serial> <channel 1-4>]\n", argv[0]);
+    return 1;
+  }
+
+  int dumpSerial = argc == 4 ? atoi(argv[2]) : -1;
+  int dumpChannel = argc == 4 ? atoi(argv[3]) - 1 : -1;
+  if (argc == 4 && (dumpChannel < 0 || dumpChannel >= READER_N_CHANNELS)) {
+    printf("Channel, %s out of range (1-4).\n", argv[3]);
+    return 1;
+  }
+
+  ColumnReader columns;
+  if (columns.Open(argv[1]))
+    return DumpColumns(columns, dumpSerial, dumpChannel);
+
+  DRSReader reader;
+  if (!reader.Open(argv[1])) {
+    printf("Cannot open '%s'.\n", argv[1]);
+    return 1;
+  }
+
+  int status;
+  long nEvents = 0;
+  long nStored = 0;
+  long nEmpty = 0;
+  float wf[READER_N_BINS];
+  float tcal[READER_N_BINS];
+
+  while ((status = reader.ReadEvent()) == 1) {
+    const event_header_t &h = reader.GetHeader();
+    nEvents++;
+
+    if (dumpChannel >= 0) {
+      if (h.serial != dumpSerial)
+        continue;
+      if (!reader.GetWaveform(0, dumpChannel, wf)) {
+        printf("Channel %d not stored in event %d.\n", dumpChannel + 1, h.serial);
+        return 1;
+      }
+      // cumulative bin widths, rotated by the trigger cell
+      float t = 0;
+      int haveTime = reader.GetTimeCalibration(0, dumpChannel, tcal);
+      for (int j = 0; j < READER_N_BINS; j++) {
+        printf("%8.3f %8.3f\n", haveTime ? t : j, wf[j]);
+        if (haveTime)
+          t += tcal[(j + reader.GetTriggerCell(0)) % READER_N_BINS];
+      }
+      return 0;
+    }
+
+    printf("%6d %04d-%02d-%02d %02d:%02d:%02d.%03d", h.serial, h.year, h.month,
+           h.day, h.hour, h.minute, h.second, h.millisecond);
+    for (int b = 0; b < reader.GetNumberOfBoards(); b++) {
+      printf("  B%d T%4d", reader.GetBoardSerialNumber(b), reader.GetTriggerCell(b));
+      for (int i = 0; i < READER_N_CHANNELS; i++) {
+        int n = reader.GetStoredSamples(b, i);
+        nStored += n;
+        if (reader.IsEmpty(b, i)) {
+          nEmpty++;
+          printf("     -");
+        } else {
+          printf(" %5d", n);
+        }
+      }
+    }
+    printf("\n");
+  }
+
+  if (status < 0)
+    printf("Corrupt record after %ld events.\n", nEvents);
+  if (dumpChannel >= 0) {
+    printf("Event %d not found.\n", dumpSerial);
+    return 1;
+  }
+  printf("%ld events, %ld samples stored, %ld empty channels\n", nEvents, nStored, nEmpty);
+  return status < 0;
+}
@@ -23,6 +23,7 @@ sudo ./drsLog $(cat config.txt)
 
 #define O_BINARY 0
 #define MAX_N_BOARDS 4
+#define N_SCALERS 5          // trigger scalers CH1-4 and EXT
 
 #include <unistd.h>
 #include <ctype.h>
@@ -38,9 +39,21 @@ sudo ./drsLog $(cat config.txt)
 #include <assert.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #include "strlcpy.h"
 #include "DRS.h"
+#include "columnFile.h"
+#include "countsLog.h"
+#include "pulseFinder.h"
+#include "histogram.h"
+#include "coincidence.h"
+#include "classifier.h"
+#include "baseline.h"
+#include "liveTime.h"
+#include "prescaler.h"
+#include "control.h"
 #include <drsLog.h>
 
 /*------------------------------------------------------------------*/
@@ -57,12 +70,238 @@ int main(int argc, char** argv) {
   m_triggerCell[0] = 0;
  
 
-  int i, j;
+  int i;
   DRS* drs;
 
-  // Should consider changing to opt
+  // Optional settings come as options before the positional arguments.
+  // The leading '+' stops at the first positional, so negative trigger
+  // levels are not mistaken for options.
+  static struct option longOptions[] = {
+    {"zs-threshold", required_argument, 0, 'z'},
+    {"zs-pre",       required_argument, 0, 'p'},
+    {"zs-post",      required_argument, 0, 'q'},
+    {"rotate-size",  required_argument, 0, 'S'},
+    {"rotate-time",  required_argument, 0, 'T'},
+    {"rotate-events", required_argument, 0, 'E'},
+    {"columnar",     required_argument, 0, 'C'},
+    {"baseline-bins", required_argument, 0, 'B'},
+    {"baseline-track", required_argument, 0, 'A'},
+    {"muon-threshold", required_argument, 0, 'M'},
+    {"cfd-fraction", required_argument, 0, 'F'},
+    {"psd",          required_argument, 0, 'D'},
+    {"psd-cut",      required_argument, 0, 'N'},
+    {"pair",         required_argument, 0, 'K'},
+    {"coincidence-window", required_argument, 0, 'W'},
+    {"classifier",   required_argument, 0, 'L'},
+    {"veto",         required_argument, 0, 'V'},
+    {"peaks",        required_argument, 0, 'P'},
+    {"reject-pileup", no_argument,      0, 'R'},
+    {"rate-interval", required_argument, 0, 'Y'},
+    {"prescale",     required_argument, 0, 'O'},
+    {"control",      required_argument, 0, 'G'},
+    {"parallel-init", no_argument,      0, 'J'},
+    {"prescale-random", no_argument,    0, 'X'},
+    {"histograms",   required_argument, 0, 'H'},
+    {"histogram-interval", required_argument, 0, 'I'},
+    {0, 0, 0, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+z:p:q:S:T:E:C:B:A:M:F:D:N:K:W:L:V:P:RY:O:XG:JH:I:", longOptions, NULL)) != -1) {
+    switch (opt) {
+    case 'z':
+      m_zeroSuppress = true;
+      m_zsThreshold = strtod(optarg, NULL);
+      if (m_zsThreshold <= 0) {
+        printf("Zero suppression threshold, %s must be positive (mV).\n", optarg);
+        return 1;
+      }
+      break;
+    case 'p':
+      m_zsPre = strtol(optarg, NULL, 10);
+      break;
+    case 'q':
+      m_zsPost = strtol(optarg, NULL, 10);
+      break;
+    case 'S':
+      m_rotateBytes = (long)(strtod(optarg, NULL) * 1024 * 1024);
+      break;
+    case 'T':
+      m_rotateSeconds = strtol(optarg, NULL, 10);
+      break;
+    case 'E':
+      m_rotateEvents = strtol(optarg, NULL, 10);
+      break;
+    case 'C':
+      m_chunkEvents = strtol(optarg, NULL, 10);
+      if (m_chunkEvents < 1) {
+        printf("Events per column chunk, %s must be at least 1.\n", optarg);
+        return 1;
+      }
+      break;
+    case 'B':
+      m_baselineBins = strtol(optarg, NULL, 10);
+      if (m_baselineBins < 1) {
+        printf("Baseline window, %s must be at least 1 bin.\n", optarg);
+        return 1;
+      }
+      break;
+    case 'A': {
+      char cells[8] = "";
+      m_trackBaseline = true;
+      if (sscanf(optarg, "%f,%7s", &m_baselineAlpha, cells) < 1 || m_baselineAlpha <= 0 ||
+          m_baselineAlpha > 1 || (cells[0] && strcmp(cells, "cells") != 0)) {
+        printf("Baseline tracking, %s must be <weight 0-1>[,cells].\n", optarg);
+        return 1;
+      }
+      m_baselinePerCell = cells[0] != 0;
+      break;
+    }
+    case 'M':
+      m_muonThreshold = strtod(optarg, NULL);
+      break;
+    case 'F':
+      m_cfdFraction = strtod(optarg, NULL);
+      if (m_cfdFraction <= 0 || m_cfdFraction >= 1) {
+        printf("CFD fraction, %s must be between 0 and 1.\n", optarg);
+        return 1;
+      }
+      break;
+    case 'D':
+      m_psd = true;
+      if (sscanf(optarg, "%f,%f,%f", &m_psdPre, &m_psdPrompt, &m_psdTotal) != 3 ||
+          m_psdPre < 0 || m_psdPrompt <= 0 || m_psdTotal <= m_psdPrompt) {
+        printf("PSD windows, %s must be <pre>,<prompt>,<total> ns with total > prompt.\n", optarg);
+        return 1;
+      }
+      break;
+    case 'N':
+      m_psdCut = strtod(optarg, NULL);
+      break;
+    case 'K': {
+      coinc_pair_t pair;
+      m_coincidence = true;
+      if (sscanf(optarg, "%d.%d,%d.%d,%f,%f", &pair.boardA, &pair.channelA, &pair.boardB,
+                 &pair.channelB, &pair.min, &pair.max) != 6 ||
+          pair.channelA < 1 || pair.channelA > 4 || pair.channelB < 1 || pair.channelB > 4) {
+        printf("Coincidence pair, %s must be <board>.<channel 1-4>,<board>.<channel 1-4>,<min>,<max>.\n", optarg);
+        return 1;
+      }
+      pair.channelA--;
+      pair.channelB--;
+      if (!m_coinc.AddPair(pair)) {
+        printf("Coincidence pair, %s not valid or more than %d pairs.\n", optarg, COINC_MAX_PAIRS);
+        return 1;
+      }
+      break;
+    }
+    case 'W':
+      m_coincidence = true;
+      m_coinc.SetWindow(strtod(optarg, NULL));
+      break;
+    case 'L':
+      if (strcmp(optarg, "amplitude") == 0)
+        m_classifier = CLASSIFIER_AMPLITUDE;
+      else if (strcmp(optarg, "psd") == 0)
+        m_classifier = CLASSIFIER_PSD;
+      else if (strcmp(optarg, "coincidence") == 0)
+        m_classifier = CLASSIFIER_COINCIDENCE;
+      else {
+        printf("Classifier, %s not valid, use amplitude, psd or coincidence.\n", optarg);
+        return 1;
+      }
+      break;
+    case 'V':
+      m_veto = true;
+      if (sscanf(optarg, "%f,%d", &m_vetoThreshold, &m_vetoSamples) < 1 || m_vetoThreshold <= 0 ||
+          m_vetoSamples < 1) {
+        printf("Veto, %s must be <mV>[,<samples>] with both positive.\n", optarg);
+        return 1;
+      }
+      break;
+    case 'P':
+      if (sscanf(optarg, "%f,%f", &m_peakThreshold, &m_peakHysteresis) < 1 || m_peakThreshold <= 0 ||
+          m_peakHysteresis < 0) {
+        printf("Peak finder, %s must be <threshold mV>[,<hysteresis mV>].\n", optarg);
+        return 1;
+      }
+      break;
+    case 'R':
+      m_rejectPileup = true;
+      break;
+    case 'Y':
+      m_rateInterval = strtol(optarg, NULL, 10);
+      if (m_rateInterval < 1) {
+        printf("Rate interval, %s must be at least 1 second.\n", optarg);
+        return 1;
+      }
+      break;
+    case 'O':
+      if (!m_prescaler.Parse(optarg)) {
+        printf("Prescale, %s not valid, use <n> or <class>=<n>,... with classes %s, %s, unclassified.\n",
+               optarg, className[CLASS_NEUTRON], className[CLASS_MUON]);
+        return 1;
+      }
+      break;
+    case 'X':
+      m_prescaler.SetRandom(true);
+      break;
+    case 'G':
+      strlcpy(m_controlFile, optarg, sizeof(m_controlFile));
+      break;
+    case 'J':
+      m_parallelInit = true;
+      break;
+    case 'H':
+      strlcpy(m_histFile, optarg, sizeof(m_histFile));
+      break;
+    case 'I':
+      m_histInterval = strtol(optarg, NULL, 10);
+      if (m_histInterval < 1) {
+        printf("Histogram interval, %s must be at least 1 second.\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      argc = 0; // fall through to usage
+    }
+  }
+  // PSD windows without a classifier choice keep -D classifying by shape
+  if (m_classifier < 0)
+    m_classifier = m_psd ? CLASSIFIER_PSD : CLASSIFIER_AMPLITUDE;
+  if (m_classifier == CLASSIFIER_PSD && !m_psd) {
+    printf("The psd classifier needs PSD windows (-D).\n");
+    return 1;
+  }
+  if (m_classifier == CLASSIFIER_COINCIDENCE)
+    m_coincidence = true;
+  if (m_rejectPileup && m_peakThreshold <= 0) {
+    printf("Pile-up rejection needs the peak finder (-P).\n");
+    return 1;
+  }
+  m_classifierConfig.muonThreshold = m_muonThreshold;
+  m_classifierConfig.psdCut = m_psdCut;
+  if (m_zsPre < 0 || m_zsPost < 0) {
+    printf("Zero suppression padding must not be negative.\n");
+    return 1;
+  }
+  if (m_zeroSuppress && m_chunkEvents) {
+    printf("Zero suppression and columnar output cannot be combined.\n");
+    return 1;
+  }
+  if (m_rotateBytes < 0 || m_rotateSeconds < 0 || m_rotateEvents < 0) {
+    printf("File rotation limits must not be negative.\n");
+    return 1;
+  }
+
+  // shift so that the positional arguments start at argv[1] again
+  if (argc > 0) {
+    argv += optind - 1;
+    argc -= optind - 1;
+  }
+
   if (argc != 16){
-    printf("Usage: %s" , argv[0]);
+    printf("Usage: %s [options]" , argv[0]);
     printf("\n      <sample speed (0.1-6)            (5.0)GSPS>");
     printf("\n      <range center                    (0.450)V>");
     printf("\n      <trigger delay                   (60.0)ns>");      
@@ -77,14 +316,101 @@ int main(int argc, char** argv) {
     printf("\n      <max time                        (3600) seconds>");
     printf("\n      <path                            ./data>");
     printf("\n      <waveformDisplay                 (F)alse>");
-    printf("\n      <particleID                      (Y)es>");
+    printf("\n      <particleID                      (Y)es, (N)o or (S)calers only>");
+    printf("\n");
+    printf("\n  Options:");
+    printf("\n      -z, --zs-threshold <mV>          zero-suppress waveforms, keep samples beyond threshold");
+    printf("\n      -p, --zs-pre <samples>           (16) samples kept before a crossing");
+    printf("\n      -q, --zs-post <samples>          (32) samples kept after a crossing");
+    printf("\n      -S, --rotate-size <MB>           start a new file after this size");
+    printf("\n      -T, --rotate-time <seconds>      start a new file after this time");
+    printf("\n      -E, --rotate-events <events>     start a new file after this many events");
+    printf("\n      -C, --columnar <events>          write waveforms in column chunks of this many events");
+    printf("\n      -B, --baseline-bins <bins>       (64) pre-trigger bins for the pulse baseline");
+    printf("\n      -A, --baseline-track <w>[,cells] track baselines over events with weight w, optionally per cell");
+    printf("\n      -M, --muon-threshold <mV>        (20) pulse height classified as muon");
+    printf("\n      -F, --cfd-fraction <fraction>    (0.5) constant fraction for pulse times");
+    printf("\n      -D, --psd <pre,prompt,total>     classify by tail/total charge, windows in ns from the pulse edge");
+    printf("\n      -N, --psd-cut <fraction>         (0.2) tail/total above which a pulse is a neutron");
+    printf("\n      -K, --pair <b.c,b.c,min,max>     time difference of a channel pair and its window in ns");
+    printf("\n      -W, --coincidence-window <ns>    (10) window for the coincidence multiplicity");
+    printf("\n      -L, --classifier <name>          amplitude, psd or coincidence (psd with -D, else amplitude)");
+    printf("\n      -V, --veto <mV>[,<samples>]      (1) drop events without samples this far below baseline, before calibration");
+    printf("\n      -P, --peaks <mV>[,<mV>]          find every pulse above threshold, hysteresis (5) mV");
+    printf("\n      -R, --reject-pileup              leave events with several pulses unclassified");
+    printf("\n      -Y, --rate-interval <sec>        write live-time-corrected rates to a .rate file");
+    printf("\n      -O, --prescale <n|class=n,...>   in counts mode also save every n-th waveform, per class");
+    printf("\n      -X, --prescale-random            save each waveform with probability 1/n instead");
+    printf("\n      -G, --control <fifo>             stay up after setup and run on commands from a named pipe");
+    printf("\n      -J, --parallel-init              initialize and lock all boards at the same time");
+    printf("\n      -H, --histograms <file>          keep online spectra, written to file (and on SIGUSR1)");
+    printf("\n      -I, --histogram-interval <sec>   (60) time between histogram snapshots");
     printf("\n");
     printf("\n      %s 0.7 0.0 800.0 R AND 00110 0.02 0.03 0.03 0.03 1 60 ./data F Y .",argv[0]);
     printf("\n");
     return 1;
   }
 
-  trigger_t trigger;
+  run_config_t run;
+  if (ParseRunArguments(argv, run))
+    return 1;
+
+  printf("All Arguments good, proceeding.\n");
+     
+  // Exit gracefully if user terminates application
+  signal(SIGINT, exitGracefully);
+  signal(SIGUSR1, requestSnapshot);
+
+  /* do initial scan, sort boards accordning to their serial numbers */
+  drs = new DRS();
+  m_drs = drs;
+  drs->SortBoards();
+
+  /* show any found board(s) */
+  for (i = 0; i < drs->GetNumberOfBoards(); i++) {
+    DRSBoard* b = drs->GetBoard(i);
+    printf("Found DRS4 evaluation board, serial #%d, firmware revision %d\n",
+           b->GetBoardSerialNumber(), b->GetFirmwareVersion());
+    if (b->GetBoardType() < 8) {
+      printf("Found pre-V4 board, aborting\n");
+      delete drs;
+      return 0;
+    }
+  }
+
+  /* exit if no board found */
+  if (drs->GetNumberOfBoards() == 0) {
+    printf("No DRS4 evaluation board found\n");
+    delete drs;
+    return 0;
+  }
+
+  /* every event carries all boards of the daisy chain */
+  m_nBoards = drs->GetNumberOfBoards();
+  if (m_nBoards > MAX_N_BOARDS) {
+    printf("Found %d boards, only the first %d are read out\n", m_nBoards, MAX_N_BOARDS);
+    m_nBoards = MAX_N_BOARDS;
+  }
+
+  /* common configuration for all boards, the slaves look for the
+     reference clock of the master, so all are initialized first */
+  unsigned long long setupNs = MonotonicNs();
+  m_waveDepth = drs->GetBoard(0)->GetChannelDepth();  // 1024 hopefully
+  ForEachBoard(drs, run, InitBoard);
+  ForEachBoard(drs, run, SetupBoard);
+  printf("%d board(s) configured in %.2f s\n", drs->GetNumberOfBoards(), (MonotonicNs() - setupNs) / 1E9);
+
+  // a daemon keeps the boards configured and runs on command
+  int status = m_controlFile[0] ? Serve(drs, run) : Run(drs, run);
+
+  /* delete DRS object -> close USB connection */
+  delete drs;
+  return status;
+}
+
+int ParseRunArguments(char** argv, run_config_t& run) {
+  // argv[1] ... argv[15] are the positional arguments
+  trigger_t& trigger = run.trigger;
 
   // Sample Speed
   double sampleSpeed; // 0.1 to 6 GS/s
@@ -194,6 +520,11 @@ int main(int argc, char** argv) {
   if(argv[14][0] == 'T'){
     waveformDisplay = true;
     printf("Saving waveforms!\n");
+    if (m_zeroSuppress)
+      printf("Zero suppression at %.1f mV, keeping %d/%d samples around crossings\n",
+             m_zsThreshold, m_zsPre, m_zsPost);
+    if (m_chunkEvents)
+      printf("Columnar output, %d events per chunk\n", m_chunkEvents);
   } else if (argv[14][0] == 'F') {
     waveformDisplay = false;
     printf("Saving counts only\n");
@@ -203,76 +534,182 @@ int main(int argc, char** argv) {
   }
 
   bool particleID = false;
+  bool scalersOnly = false;
 
   if(argv[15][0] == 'Y'){
     particleID = true;
     printf("Tracking muons and neutrons separately!\n");
   } else if(argv[15][0] == 'N'){
     printf("Tracking total particle counts\n");
+  } else if(argv[15][0] == 'S' && !waveformDisplay){
+    scalersOnly = true;
+    printf("Counting with the hardware trigger scaler, no readout\n");
   } else {
-    printf("particleID, %s not vaild, enter 'Y' for muon/neutron tracking or 'N' for total counts only.\n", argv[15]);
+    printf("particleID, %s not vaild, enter 'Y' for muon/neutron tracking, 'N' for total counts only or 'S' for scaler counts (counts only).\n", argv[15]);
     return 1;
   }
 
-  printf("All Arguments good, proceeding.\n");
-     
-  // Exit gracefully if user terminates application
-  signal(SIGINT, exitGracefully);
+  if (scalersOnly && TriggerScaler(trigger) < 0) {
+    printf("Scaler counts need a single trigger source with OR logic, the scalers count the inputs, not coincidences.\n");
+    return 1;
+  }
 
-  /* do initial scan, sort boards accordning to their serial numbers */
-  drs = new DRS();
-  m_drs = drs;
-  drs->SortBoards();
+  if (m_prescaler.IsActive() && (waveformDisplay || !particleID)) {
+    printf("Prescaled waveforms need counts mode with particleID 'Y'.\n");
+    return 1;
+  }
 
-  /* show any found board(s) */
-  for (i = 0; i < drs->GetNumberOfBoards(); i++) {
-    DRSBoard* b = drs->GetBoard(i);
-    printf("Found DRS4 evaluation board, serial #%d, firmware revision %d\n",
-           b->GetBoardSerialNumber(), b->GetFirmwareVersion());
-    if (b->GetBoardType() < 8) {
-      printf("Found pre-V4 board, aborting\n");
-      delete drs;
-      return 0;
+  run.sampleSpeed = sampleSpeed;
+  run.rangeCenter = rangeCenter;
+  run.maxEvents = maxEvents;
+  run.maxTime = maxTime;
+  strcpy(run.filepath, filepath);
+  run.waveformDisplay = waveformDisplay;
+  run.particleID = particleID;
+  run.scalersOnly = scalersOnly;
+  return 0;
+}
+
+void* InitBoard(void* arg) {
+  board_setup_t* setup = (board_setup_t*)arg;
+
+  setup->board->Init();
+  return NULL;
+}
+
+void* SetupBoard(void* arg) {
+  board_setup_t* setup = (board_setup_t*)arg;
+  DRSBoard* b = setup->board;
+
+  /* select external reference clock for slave modules */
+  /* NOTE: this only works if the clock chain is connected */
+  if (setup->index > 0) {
+    if (b->GetFirmwareVersion() >=
+        21260) {  // this only works with recent firmware versions
+      if (b->GetScaler(5) > 300000)  // check if external clock is connected
+        b->SetRefclk(true);          // switch to external reference clock
+      printf("Found slave board #%d, setting external reference clock\n", b->GetBoardSerialNumber());
     }
   }
 
-  /* exit if no board found */
-  if (drs->GetNumberOfBoards() == 0) {
-    printf("No DRS4 evaluation board found\n");
-    delete drs;
-    return 0;
+  // set sampling frequency, the PLL locks while the rest is set up and
+  // the output is prepared, Run() waits for it
+  b->SetFrequencyAsync(setup->run->sampleSpeed);
+
+  // set input range
+  b->SetInputRange(setup->run->rangeCenter);
+
+  // Set the triggers based on configuration
+  setTrigger(b, setup->run->trigger);
+  return NULL;
+}
+
+void ForEachBoard(DRS* drs, const run_config_t& run, void* (*work)(void*)) {
+  int n = drs->GetNumberOfBoards();
+  board_setup_t* setup = new board_setup_t[n];
+  pthread_t* thread = new pthread_t[n];
+
+  // each board has its own USB handle, so boards can be set up side by side
+  for (int i = 0; i < n; i++) {
+    setup[i].board = drs->GetBoard(i);
+    setup[i].index = i;
+    setup[i].run = &run;
+    setup[i].threaded = m_parallelInit && n > 1 && pthread_create(&thread[i], NULL, work, &setup[i]) == 0;
+    if (!setup[i].threaded)
+      work(&setup[i]);
   }
+  for (int i = 0; i < n; i++)
+    if (setup[i].threaded)
+      pthread_join(thread[i], NULL);
 
-  /* common configuration for all boards */
-  for (i = 0; i < drs->GetNumberOfBoards(); i++) {
-    b = drs->GetBoard(i);
-    m_board = i;
-    m_waveDepth = b->GetChannelDepth();  // 1024 hopefully
-    /* initialize board */
-    b->Init();
+  delete[] setup;
+  delete[] thread;
+}
 
-    /* select external reference clock for slave modules */
-    /* NOTE: this only works if the clock chain is connected */
-    if (i > 0) {
-      if (b->GetFirmwareVersion() >=
-          21260) {  // this only works with recent firmware versions
-        if (b->GetScaler(5) > 300000)  // check if external clock is connected
-          b->SetRefclk(true);          // switch to external reference clock
-	printf("Found slave board #%d, setting external reference clock\n", b->GetBoardSerialNumber());
-      }
-    }
+void ApplyRunConfig(DRS* drs, const run_config_t& next, const run_config_t& current) {
+  for (int i = 0; i < drs->GetNumberOfBoards(); i++) {
+    DRSBoard* b = drs->GetBoard(i);
+    // locking a new frequency is the slow part, only redo it on a change
+    if (next.sampleSpeed != current.sampleSpeed)
+      b->SetFrequencyAsync(next.sampleSpeed);
+    if (next.rangeCenter != current.rangeCenter)
+      b->SetInputRange(next.rangeCenter);
+    setTrigger(b, next.trigger);
+  }
+}
 
-    // set sampling frequency
-    b->SetFrequency(sampleSpeed, true);
+int Serve(DRS* drs, run_config_t& run) {
+  char line[1024];
+  char* argv[32];
+  int argc;
+  int runs = 0;
 
-    // set input range
-    b->SetInputRange(rangeCenter);
+  if (!m_control.Open(m_controlFile)) {
+    printf("Cannot open control pipe '%s'.\n", m_controlFile);
+    return 1;
+  }
+  printf("Boards ready, waiting for commands on %s\n", m_controlFile);
+  fflush(stdout);
 
-    // Set the triggers based on configuration
-    setTrigger(b, trigger);
+  while (!killSignalFlag) {
+    if (!m_control.GetLine(line, sizeof(line))) {
+      m_control.Read(500);
+      continue;
+    }
 
+    // split into words, argv[0] is the command like a program name
+    argc = 0;
+    for (char* w = strtok(line, " \t"); w && argc < 31; w = strtok(NULL, " \t"))
+      argv[argc++] = w;
+    argv[argc] = NULL;
+    if (argc == 0)
+      continue;
+
+    if (!strcmp(argv[0], "start") && argc == 1) {
+      printf("Run %d\n", ++runs);
+      unsigned long long t = MonotonicNs();
+      Run(drs, run);
+      printf("Run %d done after %.3f s\n", runs, (MonotonicNs() - t) / 1E9);
+    } else if (!strcmp(argv[0], "stop")) {
+      // only meaningful while running, see StopRequested()
+    } else if (!strcmp(argv[0], "quit")) {
+      break;
+    } else if (!strcmp(argv[0], "config") && argc == 16) {
+      // the positional arguments of the command line
+      run_config_t next;
+      if (ParseRunArguments(argv, next) == 0) {
+        ApplyRunConfig(drs, next, run);
+        run = next;
+      }
+    } else if (!strcmp(argv[0], "events") && argc == 2 && strtol(argv[1], NULL, 10) >= 1) {
+      run.maxEvents = strtol(argv[1], NULL, 10);
+    } else if (!strcmp(argv[0], "time") && argc == 2 && strtol(argv[1], NULL, 10) >= 1) {
+      run.maxTime = strtol(argv[1], NULL, 10);
+    } else if (!strcmp(argv[0], "path") && argc == 2 && access(argv[1], W_OK) == 0 &&
+               strlen(argv[1]) + 2 <= sizeof(run.filepath)) {
+      strcpy(run.filepath, argv[1]);
+      strcat(run.filepath, "/");
+    } else {
+      printf("Command '%s' not valid, use start, stop, quit, config <arguments>, events <n>, time <s> or path <dir>.\n",
+             argv[0]);
+    }
+    fflush(stdout);
   }
 
+  m_control.Close();
+  printf("Finished after %d runs.\n", runs);
+  return 0;
+}
+
+int Run(DRS* drs, run_config_t& run) {
+  int i, j;
+  trigger_t& trigger = run.trigger;
+  long maxEvents = run.maxEvents;
+  long maxTime = run.maxTime;
+  const char* filepath = run.filepath;
+
+  ResetRunState();
+
   // Time
   struct timeval startTime;
   gettimeofday(&startTime, NULL);
@@ -280,68 +717,26 @@ int main(int argc, char** argv) {
 
 
   
-  // Create the filename
-  char filename[256];
-  char concatBuffer[32];
-  time_t printTime = startTime.tv_sec;
-  struct tm *printfTime = localtime(&printTime);
-  strcpy(filename, filepath);
-  strftime(concatBuffer, sizeof concatBuffer, "%Y-%m-%d_%Hh%Mm%Ss", printfTime);
-  strcat(filename, concatBuffer);  
-  /*  snprintf(concatBuffer, sizeof concatBuffer, "%06ld", startTime.tv_usec);
-      strcat(filename, concatBuffer);  
-      snprintf(concatBuffer, sizeof concatBuffer, "_%dGSPS", (int) sampleSpeed);
-      strcat(filename, concatBuffer);
-      snprintf(concatBuffer, sizeof concatBuffer, "_%04dmV",(int) ((rangeCenter)*1000));
-      strcat(filename, concatBuffer);
-      snprintf(concatBuffer, sizeof concatBuffer, "_%06dnsDelay",  (int) trigger.triggerDelay);
-      strcat(filename, concatBuffer);
-      if(trigger.triggerPolarity){
-      strcat(filename, "_Fall");
-      } else {
-      strcat(filename, "_Rise");
-      }
-      if(trigger.triggerLogic){
-      strcat(filename, "_AND");
-      } else {   
-      strcat(filename, "__OR");
-      }
-  */
-  for (unsigned int i = 0; i < sizeof(trigger.triggerSource) / sizeof(trigger.triggerSource[0]) ; i++) {
-    if(i == sizeof(trigger.triggerSource) / sizeof(trigger.triggerSource[0])-1){
-      strcat(filename, "_EXT-");
-      if(trigger.triggerSource[i]){
-        strcat(filename, "T");
-      } else {
-        strcat(filename, "F");
-      }
-    } else {
-      strcat(filename, "_CH");
-      if(trigger.triggerSource[i]){
-	snprintf(concatBuffer, sizeof concatBuffer, "%d-%04dmV", i+1, (int) (trigger.triggerLevel[i]*1000));
-      }
-      /*
-	} else {
-	snprintf(concatBuffer, sizeof concatBuffer, "%d-BP", i+1);      
-	}
-      */
-      strcat(filename, concatBuffer);
-    }
+  m_fd = OpenOutput(filename, filepath, trigger);
+  if (m_fd < 0) {
+    printf("Cannot create output file '%s'.\n", filename);
+    return 1;
+  }
+  if (m_rateInterval && !OpenRates(filename, run.scalersOnly)) {
+    printf("Cannot create rate file for '%s'.\n", filename);
+    close(m_fd);
+    m_fd = 0;
+    return 1;
   }
-  /*
-    snprintf(concatBuffer, sizeof concatBuffer, "_%07ld-Events", maxEvents);
-    strcat(filename, concatBuffer);
-    snprintf(concatBuffer, sizeof concatBuffer, "_%08ld-Seconds", maxTime);
-    strcat(filename, concatBuffer); 
-  */
-  strcat(filename, ".dat");
 
-  printf("Logging data in: %s\n", filename);
-  fflush(stdout);
-  
-  m_fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  /* frequency locks started in the board setup */
+  for (i = 0; i < drs->GetNumberOfBoards(); i++)
+    drs->GetBoard(i)->WaitFrequencyLock();
 
-  if (waveformDisplay == true) { 
+  if (run.waveformDisplay == true) { 
+    unsigned long long startNs = MonotonicNs();
+    m_runStartWall = (long long)startTime.tv_sec * 1000000000LL + startTime.tv_usec * 1000LL;
+    m_live.Start(0);
     
     // Repeat untiul maxEvents or maxTime
     for (i = 0; i < maxEvents; i++) {
@@ -350,38 +745,58 @@ int main(int argc, char** argv) {
       m_drs->GetBoard(m_board)->GetBoardType();
 
       /* start boards (activate domino wave), master is last */
-      for (j = drs->GetNumberOfBoards() - 1; j >= 0; j--) {
+      for (j = m_nBoards - 1; j >= 0; j--) {
 	drs->GetBoard(j)->StartDomino();
       }
+      ArmLiveTime(MonotonicNs() - startNs);
+
+      /* switch files while the boards are armed, a trigger arriving
+         meanwhile is held by the board and read out below */
+      if (RotationDue(m_fileBytes)) {
+	CloseOutput(m_fd);
+	m_fd = OpenOutput(filename, filepath, trigger);
+	if (m_fd < 0) {
+	  printf("Cannot create output file '%s'.\n", filename);
+	  break;
+	}
+      }
 
       /* wait for trigger on master board */
       while (drs->GetBoard(0)->IsBusy()) {
 	struct timeval cTime;
 	gettimeofday(&cTime, NULL);
-	if (killSignalFlag | (cTime.tv_sec - startTime.tv_sec >= maxTime)) {
+	if (StopRequested() | (cTime.tv_sec - startTime.tv_sec >= maxTime)) {
 	  if (m_fd){
-	    close(m_fd);
+	    CloseOutput(m_fd);
 	  }
-	  delete drs;
 	  printf("Program finished after %d events and %ld seconds. \n", i , cTime.tv_sec-startTime.tv_sec);
+	  PrintLiveTime(MonotonicNs() - startNs);
+	  PrintVetoStatistics();
 	  fflush(stdout);
 	  return 0;
 	}
       }
 
-      for (j = 0; j < drs->GetNumberOfBoards(); j++) {
-	m_board = j;
-	drs->GetBoard(j);
-	if (drs->GetBoard(0)->IsBusy()) {
-	  i--; /* skip that event, must be some fake trigger */
+      /* all boards must have stopped, otherwise it was a fake trigger */
+      for (j = 0; j < m_nBoards; j++) {
+	if (drs->GetBoard(j)->IsBusy())
 	  break;
-	}
-	m_board = j;
+      }
+      m_live.Trigger(MonotonicNs() - startNs, j == m_nBoards);
+      if (j < m_nBoards) {
+	i--; /* skip that event, must be some fake trigger */
+	continue;
+      }
 
-	ReadWaveforms();
-	SaveWaveforms(m_fd);
+      /* one record per event, covering every board of the chain */
+      if (!ReadAcceptedWaveforms()) {
+	i--; /* rejected by the raw ADC veto */
+	continue;
       }
-    
+      if (m_chunkEvents)
+	SaveColumns(m_fd);
+      else
+	SaveWaveforms(m_fd);
 
       /* print some progress indication */
       printf("\rEvent #%d read successfully\n", i);
@@ -389,142 +804,520 @@ int main(int argc, char** argv) {
 
     }
 
-    if (m_fd){
-      close(m_fd);
+    if (m_fd > 0){
+      CloseOutput(m_fd);
     }
     m_fd = 0;
     struct timeval currentTime;
     gettimeofday(&currentTime, NULL);
     printf("Program finished after %d events and %ld seconds. \n", i , currentTime.tv_sec-startTime.tv_sec);
+    PrintLiveTime(MonotonicNs() - startNs);
+    PrintVetoStatistics();
     fflush(stdout);
-
-
-    /* delete DRS object -> close USB connection */
-    delete drs;
     return 0;
   } else {
     printf("Not saving waveforms!\n");
-    FILE * data;
-    data = fopen(filename, "a");
-    int minuteTrack = 0;
-    int countTrack = 0;
-    int countMuon = 0;
-    int countNeutron = 0;
-    int countMinute = 0;
-    int countMinuteMuon = 0;
-    int countMinuteNeutron = 0;
-    int minuteHold = 0;
-    int isMuon = -1;
-
-    time_t rawtime;
-    // Repeat until maxTime
-
-    while(true){
-      //  printf("Starting data collection!\n");
-      
-      m_drs->GetBoard(m_board);
-      m_drs->GetBoard(m_board)->GetBoardType();
+    if (run.scalersOnly)
+      return CountScalers(drs, filepath, trigger, maxTime, startTime);
+
+    // the classifier is fixed for the run, each policy has its own loop
+    switch (m_classifier) {
+    case CLASSIFIER_PSD:
+      return CountEvents<PsdClassifier>(drs, filepath, trigger, run.particleID, maxTime, startTime);
+    case CLASSIFIER_COINCIDENCE:
+      return CountEvents<CoincidenceClassifier>(drs, filepath, trigger, run.particleID, maxTime, startTime);
+    default:
+      return CountEvents<AmplitudeClassifier>(drs, filepath, trigger, run.particleID, maxTime, startTime);
+    }
+  }
+  
 
-      /* start boards (activate domino wave), master is last */
-      for (j = drs->GetNumberOfBoards() - 1; j >= 0; j--) {
-	drs->GetBoard(j)->StartDomino();
-      }
-     
-      
-      /* wait for trigger on master board */
-      while (drs->GetBoard(0)->IsBusy()) {
-	struct timeval cuTime;
+}
 
-	gettimeofday(&cuTime, NULL);
-	
-	if (killSignalFlag | (cuTime.tv_sec - startTime.tv_sec >= maxTime)) {
-  
-	  time( &rawtime );
-	  fprintf(data, "%d %d %d %s", countMinute, countMinuteMuon, countMinuteNeutron, asctime(localtime(&rawtime)));
-	  fclose(data);
-	  delete drs;
+template <class Classifier>
+int CountEvents(DRS* drs, const char* filepath, trigger_t& trigger, bool particleID, long maxTime,
+                struct timeval startTime) {
+  int j;
+  FILE * data;
+  data = fdopen(m_fd, "a");
+  m_fd = 0;
+  int countTrack = 0;
+  ClassCounter classes;
+
+  // Every event goes to the binary counts stream with a monotonic
+  // timestamp, the per-minute text lines are binned from the same times
+  unsigned long long startNs = MonotonicNs();
+  unsigned long long maxTimeNs = maxTime * 1000000000ULL;
+  m_runStartWall = (long long)startTime.tv_sec * 1000000000LL + startTime.tv_usec * 1000LL;
+  m_live.Start(0);
+  CountsWriter counts;
+  CountsBinner minutes(60);
+  count_record_t record;
+  memset(&record, 0, sizeof(record));
+  if (!OpenCounts(counts, filename) || (m_prescaler.IsActive() && !OpenPrescaled(filename))) {
+    printf("Cannot create counts file for '%s'.\n", filename);
+    CloseCountsOutput(data);
+    return 1;
+  }
+  unsigned long long nextSnapshot = m_histInterval * 1000000000ULL;
+  if (m_histFile[0] && particleID)
+    BookHistograms();
 
+  // Repeat until maxTime
+  while(true){
+    //  printf("Starting data collection!\n");
 
-	  printf("Program finished after %d events and %ld seconds. Totals: %d muons and %d neutrons. \n", countTrack , cuTime.tv_sec-startTime.tv_sec, countMuon, countNeutron);
-	  
-	  fflush(data);
-	  return 0;
-	}
+    /* start boards (activate domino wave), master is last */
+    for (j = m_nBoards - 1; j >= 0; j--) {
+      drs->GetBoard(j)->StartDomino();
+    }
+    ArmLiveTime(MonotonicNs() - startNs);
+
+    /* histogram snapshot on the timer or on request */
+    PollSnapshot(MonotonicNs() - startNs, nextSnapshot);
+
+    /* switch files while the boards are armed, the size is the text,
+       counts and prescaled waveform files together */
+    if (RotationDue(ftell(data) + counts.GetBytes() + m_fileBytes)) {
+      fclose(data);
+      data = NULL;
+      int fd = OpenOutput(filename, filepath, trigger);
+      if (fd >= 0 && (data = fdopen(fd, "a")) == NULL)
+	close(fd);
+      if (!data || !OpenCounts(counts, filename) || (m_prescaleFd && !OpenPrescaled(filename))) {
+	printf("Cannot create output file '%s'.\n", filename);
+	CloseCountsOutput(data);
+	return 1;
       }
-      //Code only reaches this point if there is an event; otherwise will stay in previous loop forever.
-      //Next section works because only 1 board; otherwise would have multiple printf statements
-      for (j = 0; j < drs->GetNumberOfBoards(); j++) {
-	m_board = j;
-	drs->GetBoard(j);
-	if (drs->GetBoard(0)->IsBusy()) {
-	  i--; /* skip that event, must be some fake trigger */
-	  break;
-	}
-	m_board = j;
-	if (particleID == true) {
-	  ReadWaveforms();
-	  isMuon = searchWaveforms();
-
-	  if (isMuon == 1) {
-	    countMuon++;
-	    countMinuteMuon++;
-	  }
-	  if (isMuon == 0){
-	    countNeutron++;
-	    countMinuteNeutron++;
-	  }
-	}
-	struct timeval curTime;
-	gettimeofday(&curTime, NULL);
+    }
+      
+    /* wait for trigger on master board */
+    bool finished = false;
+    while (drs->GetBoard(0)->IsBusy()) {
+      unsigned long long t = MonotonicNs() - startNs;
+      if (StopRequested() | (t >= maxTimeNs)) {
+	finished = true;
+	break;
+      }
+      // snapshots are due also while no triggers arrive
+      PollSnapshot(t, nextSnapshot);
+    }
+    if (finished)
+      break;
 
-	if (countTrack == 0) printf("First event has been recorded!\n");
+    //Code only reaches this point if there is an event; otherwise will stay in previous loop forever.
+    for (j = 0; j < m_nBoards; j++) {
+      if (drs->GetBoard(j)->IsBusy())
+	break;
+    }
+    record.time = MonotonicNs() - startNs;
+    m_live.Trigger(record.time, j == m_nBoards);
+    if (j < m_nBoards)
+      continue; /* skip that event, must be some fake trigger */
+
+    record.serial = countTrack + 1;
+    record.classification = CLASS_NONE;
+    record.flags = 0;
+    record.psd = 0;
+    record.dt = 0;
+    record.multiplicity = 0;
+    record.pairMask = 0;
+    memset(record.pairDt, 0, sizeof(record.pairDt));
+    memset(record.pulseTime, 0, sizeof(record.pulseTime));
+    memset(record.amplitude, 0, sizeof(record.amplitude));
+
+    if (particleID == true && !ReadAcceptedWaveforms()) {
+      // counted, but neither calibrated nor classified
+      record.flags |= COUNT_FLAG_VETO;
+    } else if (particleID == true) {
+      searchWaveforms(record);
+      if (m_coincidence)
+	FindCoincidences(record);
+      if (!m_rejectPileup || !(record.flags & COUNT_FLAG_PILEUP))
+	record.classification = Classifier::Classify(record, m_classifierConfig);
+      if (m_nHist)
+	FillHistograms(record);
+    }
+    classes.Add(record.classification);
 
-	time( &rawtime );
+    /* a prescaled sample of the waveforms, serials match the .cnt records */
+    bool saved = false;
+    if (m_prescaleFd && !(record.flags & COUNT_FLAG_VETO) && m_prescaler.Accept(record.classification)) {
+      m_evSerial = record.serial;
+      saved = (m_chunkEvents ? SaveColumns(m_prescaleFd) : SaveWaveforms(m_prescaleFd)) > 0;
+    }
 
-	countTrack++;
-	countMinute++;
+    if (countTrack == 0) printf("First event has been recorded!\n");
 
-        minuteTrack = (curTime.tv_sec - startTime.tv_sec) / 60;
-	if (minuteTrack != minuteHold) {
-	  fprintf(data, "%d %d %d %s", countMinute-1, countMinuteMuon-1, countMinuteNeutron-1, asctime(localtime(&rawtime)));
-	  fflush(data);
-	  /* print some progress indication */
-	  printf("%d events saved this minute\n", countMinute-1);
-	  countMinute = 1;
-	  countMinuteMuon = 1;
-	  countMinuteNeutron = 1;
-	}
-	minuteHold = minuteTrack;
+    countTrack++;
+    if (!saved)
+      m_fileEvents++; /* else already counted by the save */
 
-      }
+    // a finished minute is written out together with the pending records
+    if (minutes.Advance(record.time, WriteMinute, data))
+      counts.Flush();
+    minutes.Add(record.classification);
+    counts.Add(record);
+
+    fflush(stdout);
+  }
+
+  double seconds = (MonotonicNs() - startNs) / 1E9;
+  printf("Program finished after %d events and %.0f seconds. ", countTrack, seconds);
+  classes.Print(seconds);
+  PrintLiveTime(MonotonicNs() - startNs);
+  if (m_peakThreshold > 0)
+    printf("Pile-up in %ld of %d events (%.2f%%)%s.\n", m_pileupEvents, countTrack,
+           countTrack ? 100.0 * m_pileupEvents / countTrack : 0, m_rejectPileup ? ", not classified" : "");
+  PrintVetoStatistics();
+  if (m_prescaleFd) {
+    m_prescaler.Print();
+    CloseOutput(m_prescaleFd);
+  }
+  m_prescaleFd = 0;
+
+  // the minutes up to the end of the run, also the empty ones, then the
+  // last, partial minute labelled with its end like the others
+  minutes.Advance(MonotonicNs() - startNs, WriteMinute, data);
+  const counts_bin_t& last = minutes.GetCurrent();
+  PrintCounts(data, last, (time_t)((m_runStartWall + (long long)last.end) / 1000000000LL));
+  counts.Close();
+  if (m_nHist)
+    SnapshotHistograms();
     
-      fflush(stdout);
-      i++;
+  fflush(stdout);
+  fclose(data);
+  return 0;
+}
+
+int CountScalers(DRS* drs, const char* filepath, trigger_t& trigger, long maxTime, struct timeval startTime) {
+  FILE * data;
+  data = fdopen(m_fd, "a");
+  m_fd = 0;
+
+  // scalers 0-4 count the CH1-4 and EXT trigger inputs over the last
+  // 100 ms (GetScaler scales it to Hz), older firmware returns 0, scaler 5
+  // is the reference clock input and is not counted; the triggers are the
+  // singles of the one source of the master board
+  int source = TriggerScaler(trigger);
+  if (source < 0) {
+    printf("Scaler counts need a single trigger source with OR logic.\n");
+    CloseCountsOutput(data);
+    return 1;
+  }
+  for (int b = 0; b < m_nBoards; b++) {
+    if (drs->GetBoard(b)->GetBoardType() < 9 || drs->GetBoard(b)->GetFirmwareVersion() < 21000) {
+      printf("Board %d has no trigger scalers (firmware 21000 or later needed).\n",
+             drs->GetBoard(b)->GetBoardSerialNumber());
+      CloseCountsOutput(data);
+      return 1;
     }
-  
-    if (m_fd){
-      close(m_fd);
+  }
+
+  unsigned long long startNs = MonotonicNs();
+  unsigned long long maxTimeNs = maxTime * 1000000000ULL;
+  unsigned long long period = 100000000ULL; // one scaler measurement
+  unsigned long long last = 0, next = period;
+  unsigned long long rateStart = 0, nextRate = m_rateInterval * 1000000000ULL;
+  m_runStartWall = (long long)startTime.tv_sec * 1000000000LL + startTime.tv_usec * 1000LL;
+  int n = m_nBoards * N_SCALERS;
+  double total = 0;
+  double rate[MAX_N_BOARDS * N_SCALERS];
+  double minuteCounts[MAX_N_BOARDS * N_SCALERS];
+  double rateCounts[MAX_N_BOARDS * N_SCALERS];
+  memset(minuteCounts, 0, sizeof(minuteCounts));
+  memset(rateCounts, 0, sizeof(rateCounts));
+  counts_bin_t minute;
+  memset(&minute, 0, sizeof(minute));
+  minute.end = 60000000000ULL;
+
+  /* arm once, the trigger logic and the scalers keep running without readout */
+  for (int j = m_nBoards - 1; j >= 0; j--)
+    drs->GetBoard(j)->StartDomino();
+
+  while (!StopRequested()) {
+    unsigned long long t = MonotonicNs() - startNs;
+    if (t < next) {
+      usleep((next - t) / 1000);
+      continue;
+    }
+    if (t > maxTimeNs)
+      t = maxTimeNs;
+
+    // integrate the rate over the time since the last sample, split at
+    // the minute boundary so every line gets its share
+    for (int b = 0; b < m_nBoards; b++)
+      for (int i = 0; i < N_SCALERS; i++)
+	rate[b * N_SCALERS + i] = drs->GetBoard(b)->GetScaler(i);
+    while (t >= minute.end) {
+      for (int i = 0; i < n; i++)
+	minuteCounts[i] += rate[i] * (minute.end - last) / 1E9;
+      last = minute.end;
+      double triggers = minuteCounts[source];
+      minute.total = (int)(triggers + 0.5);
+      PrintCounts(data, minute, (time_t)((m_runStartWall + (long long)minute.end) / 1000000000LL),
+		  minuteCounts, n);
+      printf("%d triggers counted this minute\n", minute.total);
+      total += triggers;
+      memset(minuteCounts, 0, sizeof(minuteCounts));
+      minute.start = minute.end;
+      minute.end += 60000000000ULL;
+    }
+    for (int i = 0; i < n; i++) {
+      minuteCounts[i] += rate[i] * (t - last) / 1E9;
+      rateCounts[i] += rate[i] * (t - last) / 1E9;
+    }
+    last = t;
+    next += period;
+
+    if (m_rateFile && t >= nextRate) {
+      // the board is never read out, so the whole interval is live
+      live_interval_t r;
+      r.start = rateStart;
+      r.end = t;
+      r.live = t - rateStart;
+      r.dead = 0;
+      r.events = (long)(rateCounts[source] + 0.5);
+      WriteRates(r, rateCounts, n);
+      memset(rateCounts, 0, sizeof(rateCounts));
+      rateStart = t;
+      nextRate += m_rateInterval * 1000000000ULL;
+    }
+
+    /* switch files between samples, the text file is all there is */
+    if (RotationDue(ftell(data))) {
+      fclose(data);
+      data = NULL;
+      int fd = OpenOutput(filename, filepath, trigger);
+      if (fd >= 0 && (data = fdopen(fd, "a")) == NULL)
+	close(fd);
+      if (!data) {
+	printf("Cannot create output file '%s'.\n", filename);
+	CloseCountsOutput(data);
+	return 1;
+      }
     }
-    m_fd = 0;
-    struct timeval currTime;
-    gettimeofday(&currTime, NULL);
 
-    printf("Program finished after %d events and %ld seconds. Totals: %d muons and %d neutrons. \n", countTrack-1 , currTime.tv_sec-startTime.tv_sec, countMuon, countNeutron);
+    if (t >= maxTimeNs)
+      break;
+  }
 
-    // time_t rawtime;
-    time( &rawtime );
-    fprintf(data, "%d %d %d %s", countMinute, countMinuteMuon, countMinuteNeutron, asctime(localtime(&rawtime)));
-    
-    fflush(stdout);
+  double triggers = minuteCounts[source];
+  total += triggers;
+  double seconds = last / 1E9;
+  printf("Program finished after %.0f seconds, %.0f triggers counted by the scalers (%.3f Hz).\n",
+         seconds, total, seconds > 0 ? total / seconds : 0);
+
+  // the last, partial minute
+  minute.total = (int)(triggers + 0.5);
+  PrintCounts(data, minute, time(NULL), minuteCounts, n);
+  if (m_rateFile)
+    fclose(m_rateFile);
+  m_rateFile = NULL;
+
+  fflush(stdout);
+  fclose(data);
+  return 0;
+}
+
+void CloseCountsOutput(FILE* data) {
+  // a counts run that stops early, the counts stream closes with its
+  // writer; the daemon starts many runs, nothing may stay open
+  if (data)
     fclose(data);
+  if (m_prescaleFd)
+    CloseOutput(m_prescaleFd);
+  m_prescaleFd = 0;
+  if (m_rateFile)
+    fclose(m_rateFile);
+  m_rateFile = NULL;
+}
 
-    /* delete DRS object -> close USB connection */
-    delete drs;
-    return 0;
+int TriggerScaler(const trigger_t& trigger) {
+  // with one source and OR logic every count of its scaler is a trigger,
+  // coincidences and overlapping inputs cannot be told from the singles
+  int source = -1;
+  if (trigger.triggerLogic)
+    return -1;
+  for (int i = 0; i < N_SCALERS; i++)
+    if (trigger.triggerSource[i]) {
+      if (source >= 0)
+	return -1;
+      source = i;
+    }
+  return source;
+}
+
+void ReplaceExtension(char* name, int size, const char* filename, const char* ext) {
+  // "xxx.dat" -> "xxx<ext>"
+  strlcpy(name, filename, size);
+  char* dot = strrchr(name, '.');
+  if (dot)
+    *dot = 0;
+  strlcat(name, ext, size);
+}
+
+bool OpenRates(const char* filename, bool scalers) {
+  char name[1024];
+  ReplaceExtension(name, sizeof(name), filename, ".rate");
+  m_rateFile = fopen(name, "w");
+  if (!m_rateFile)
+    return false;
+  m_live.SetInterval(m_rateInterval);
+  if (scalers)
+    fprintf(m_rateFile, "# end(s since epoch) triggers live(s) dead(s) live_fraction rate(Hz) live_rate(Hz) counts CH1-4 EXT per board\n");
+  else
+    fprintf(m_rateFile, "# end(s since epoch) events live(s) dead(s) live_fraction rate(Hz) live_rate(Hz) scaler0-5(Hz, board 0)\n");
+  return true;
+}
+
+void ArmLiveTime(unsigned long long t) {
+  m_live.Arm(t);
+  if (m_rateFile && m_live.Due(t))
+    WriteRates(m_live.Close(t));
+}
 
+void WriteRates(const live_interval_t& r, const double* scalers, int nScalers) {
+  double length = (r.end - r.start) / 1E9;
+
+  fprintf(m_rateFile, "%.3f %ld %.6f %.6f %.4f %.3f %.3f", (m_runStartWall + (long long)r.end) / 1E9,
+          r.events, r.live / 1E9, r.dead / 1E9, length > 0 ? r.live / 1E9 / length : 0,
+          length > 0 ? r.events / length : 0, LiveRate(r));
+  if (scalers) {
+    // counts integrated by the caller over the interval
+    for (int i = 0; i < nScalers; i++)
+      fprintf(m_rateFile, " %.0f", scalers[i]);
+  } else {
+    // the board counts triggers in hardware, also while it is read out
+    for (int i = 0; i < 6; i++)
+      fprintf(m_rateFile, " %u", m_drs->GetBoard(0)->GetScaler(i));
   }
-  
+  fprintf(m_rateFile, "\n");
+  fflush(m_rateFile);
+}
+
+void PrintLiveTime(unsigned long long t) {
+  live_interval_t r = m_live.GetTotal(t);
+  if (m_rateFile)
+    fclose(m_rateFile);
+  m_rateFile = NULL;
+  if (r.events == 0)
+    return;
+  printf("Live time %.1f s of %.1f s (%.1f%%), %.1f us dead per event, live-time-corrected rate %.3f Hz.\n",
+         r.live / 1E9, (r.end - r.start) / 1E9, 100.0 * r.live / (r.end - r.start), r.dead / 1E3 / r.events,
+         LiveRate(r));
+}
+
+bool OpenPrescaled(const char* filename) {
+  // "xxx.dat" -> "xxx_wf.dat", in the format of the waveform mode
+  char name[1024];
+  ReplaceExtension(name, sizeof(name), filename, "_wf.dat");
+
+  if (m_prescaleFd)
+    CloseOutput(m_prescaleFd);
+  m_prescaleFd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  m_timeHeader = true;
+  if (m_prescaleFd < 0)
+    m_prescaleFd = 0;
+  return m_prescaleFd > 0;
+}
 
+bool OpenCounts(CountsWriter& counts, const char* filename) {
+  // binary stream next to the text file
+  char name[256];
+  ReplaceExtension(name, sizeof(name), filename, ".cnt");
+
+  counts.Close();
+  return counts.Open(name, m_runStartWall);
+}
+
+void PrintCounts(FILE* data, const counts_bin_t& bin, time_t label, const double* scalers, int nScalers) {
+  PrintBinCounts(data, bin);
+  for (int i = 0; i < nScalers; i++)
+    fprintf(data, "%.0f ", scalers[i]);
+  fprintf(data, "%s", asctime(localtime(&label)));
+  fflush(data);
+}
+
+void WriteMinute(const counts_bin_t& bin, void* arg) {
+  // label the line with the wall clock time at the end of the minute
+  PrintCounts((FILE*)arg, bin, (time_t)((m_runStartWall + (long long)bin.end) / 1000000000LL));
+  /* print some progress indication */
+  printf("%d events saved this minute\n", bin.total);
+}
+
+void FindCoincidences(count_record_t& record) {
+  float dt[COINC_MAX_PAIRS];
+  int mask;
+
+  m_coinc.Clear();
+  for (int b = 0; b < m_nBoards; b++)
+    for (int i = 0; i < 4; i++) {
+      const float *time = m_tcalon ? m_time[b][i] : NULL;
+      // the pads of the first board are already measured
+      if (b > 0 || i > 1)
+	MeasurePulse(b, i);
+      if (m_pulse[b][i].amplitude <= 5 * m_pulse[b][i].baselineRms)
+	continue;
+      float t = CfdTime(PulseWaveform(b, i), time, &m_pulse[b][i], m_cfdFraction);
+      if (t >= 0)
+	m_coinc.AddHit(b, i, t, m_pulse[b][i].amplitude);
+    }
+
+  record.multiplicity = m_coinc.Build(dt, &mask);
+  record.pairMask = mask;
+  for (int i = 0; i < m_coinc.GetNumberOfPairs(); i++)
+    record.pairDt[i] = dt[i];
+}
+
+void BookHistograms() {
+  m_hist[m_nHist++] = new Histogram("amplitude_top", 1000, 0, 1000);
+  m_hist[m_nHist++] = new Histogram("amplitude_bottom", 1000, 0, 1000);
+  m_hist[m_nHist++] = new Histogram("time_top", 1000, 0, 1000);
+  m_hist[m_nHist++] = new Histogram("time_bottom", 1000, 0, 1000);
+  m_hist[m_nHist++] = new Histogram("dt", 400, -20, 20);
+  m_hist[m_nHist++] = new Histogram("psd", 200, 0, 1);
+  m_hist[m_nHist++] = new Histogram("psd_vs_amplitude", 100, 0, 1000, 100, 0, 1);
+  m_hist[m_nHist++] = new Histogram("peaks_top", 10, 0, 10);
+  m_hist[m_nHist++] = new Histogram("peaks_bottom", 10, 0, 10);
+}
+
+void FillHistograms(const count_record_t& r) {
+  // same order as BookHistograms
+  m_hist[0]->Fill(r.amplitude[0]);
+  m_hist[1]->Fill(r.amplitude[1]);
+  if (r.flags & COUNT_FLAG_TIME(0))
+    m_hist[2]->Fill(r.pulseTime[0]);
+  if (r.flags & COUNT_FLAG_TIME(1))
+    m_hist[3]->Fill(r.pulseTime[1]);
+  if (r.flags & COUNT_FLAG_DT)
+    m_hist[4]->Fill(r.dt);
+  if (r.flags & COUNT_FLAG_PSD) {
+    m_hist[5]->Fill(r.psd);
+    m_hist[6]->Fill2D(r.amplitude[0] > r.amplitude[1] ? r.amplitude[0] : r.amplitude[1], r.psd);
+  }
+  if (m_peakThreshold > 0) {
+    m_hist[7]->Fill(r.nPeaks[0]);
+    m_hist[8]->Fill(r.nPeaks[1]);
+  }
+}
+
+void PollSnapshot(unsigned long long t, unsigned long long& nextSnapshot) {
+  // the shards merge without locks, safe while the boards are armed
+  if (m_nHist && (m_histSnapshot || t >= nextSnapshot)) {
+    SnapshotHistograms();
+    m_histSnapshot = 0;
+    nextSnapshot = t + m_histInterval * 1000000000ULL;
+  }
+}
+
+void SnapshotHistograms() {
+  if (!WriteHistograms(m_histFile, m_hist, m_nHist))
+    printf("Cannot write histograms to '%s'.\n", m_histFile);
+}
+
+void requestSnapshot(int sig) {
+  m_histSnapshot = 1;
 }
 
 int setTrigger(DRSBoard* board, trigger_t trigger) {
@@ -563,56 +1356,194 @@ int setTrigger(DRSBoard* board, trigger_t trigger) {
   return 0;
 }
 
+int OpenOutput(char* filename, const char* filepath, trigger_t& trigger) {
+  // Create the filename
+  char concatBuffer[32];
+  time_t printTime = time(NULL);
+  struct tm *printfTime = localtime(&printTime);
+  strcpy(filename, filepath);
+  strftime(concatBuffer, sizeof concatBuffer, "%Y-%m-%d_%Hh%Mm%Ss", printfTime);
+  strcat(filename, concatBuffer);  
+  /*  snprintf(concatBuffer, sizeof concatBuffer, "%06ld", startTime.tv_usec);
+      strcat(filename, concatBuffer);  
+      snprintf(concatBuffer, sizeof concatBuffer, "_%dGSPS", (int) sampleSpeed);
+      strcat(filename, concatBuffer);
+      snprintf(concatBuffer, sizeof concatBuffer, "_%04dmV",(int) ((rangeCenter)*1000));
+      strcat(filename, concatBuffer);
+      snprintf(concatBuffer, sizeof concatBuffer, "_%06dnsDelay",  (int) trigger.triggerDelay);
+      strcat(filename, concatBuffer);
+      if(trigger.triggerPolarity){
+      strcat(filename, "_Fall");
+      } else {
+      strcat(filename, "_Rise");
+      }
+      if(trigger.triggerLogic){
+      strcat(filename, "_AND");
+      } else {   
+      strcat(filename, "__OR");
+      }
+  */
+  for (unsigned int i = 0; i < sizeof(trigger.triggerSource) / sizeof(trigger.triggerSource[0]) ; i++) {
+    if(i == sizeof(trigger.triggerSource) / sizeof(trigger.triggerSource[0])-1){
+      strcat(filename, "_EXT-");
+      if(trigger.triggerSource[i]){
+        strcat(filename, "T");
+      } else {
+        strcat(filename, "F");
+      }
+    } else {
+      strcat(filename, "_CH");
+      if(trigger.triggerSource[i]){
+	snprintf(concatBuffer, sizeof concatBuffer, "%d-%04dmV", i+1, (int) (trigger.triggerLevel[i]*1000));
+      }
+      /*
+	} else {
+	snprintf(concatBuffer, sizeof concatBuffer, "%d-BP", i+1);      
+	}
+      */
+      strcat(filename, concatBuffer);
+    }
+  }
+  /*
+    snprintf(concatBuffer, sizeof concatBuffer, "_%07ld-Events", maxEvents);
+    strcat(filename, concatBuffer);
+    snprintf(concatBuffer, sizeof concatBuffer, "_%08ld-Seconds", maxTime);
+    strcat(filename, concatBuffer); 
+  */
+  // rotated files can start within the same second, number them
+  if (m_rotateBytes || m_rotateSeconds || m_rotateEvents) {
+    snprintf(concatBuffer, sizeof concatBuffer, "_%03d", m_filePart);
+    strcat(filename, concatBuffer);
+  }
+  strcat(filename, ".dat");
+
+  printf("Logging data in: %s\n", filename);
+  fflush(stdout);
+
+  // every file starts with its own time calibration header
+  m_timeHeader = true;
+  m_fileBytes = 0;
+  m_fileEvents = 0;
+  m_fileOpened = printTime;
+  m_filePart++;
+
+  return open(filename, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0644);
+}
+
+bool RotationDue(long bytes) {
+  if (m_rotateBytes && bytes >= m_rotateBytes)
+    return true;
+  if (m_rotateEvents && m_fileEvents >= m_rotateEvents)
+    return true;
+  if (m_rotateSeconds && time(NULL) - m_fileOpened >= m_rotateSeconds)
+    return true;
+  return false;
+}
+
+unsigned char *WriteTimeHeader(unsigned char *p) {
+  float t;
+
+  // time calibration header
+  memcpy(p, "TIME", 4);
+  p += 4;
+
+  for (int b = 0; b < m_nBoards; b++) {
+    // store board serial number
+    sprintf((char*)p, "B#");
+    p += 2;
+    *(unsigned short*)p = m_drs->GetBoard(b)->GetBoardSerialNumber();
+    p += sizeof(unsigned short);
+
+    for (int i = 0; i < 4; i++) {
+      // if (m_chnOn[b][i]) {
+      sprintf((char*)p, "C%03d", i + 1);
+      p += 4;
+      float tcal[2048];
+      m_drs->GetBoard(b)->GetTimeCalibration(0, i * 2, 0, tcal, 0);
+      for (int j = 0; j < m_waveDepth; j++) {
+        // save binary time as 32-bit float value
+        if (m_waveDepth == 2048) {
+          t = (tcal[j % 1024] + tcal[(j + 1) % 1024]) / 2;
+          j++;
+        } else
+          t = tcal[j];
+        *(float*)p = t;
+        p += sizeof(float);
+      }
+      //   }
+    }
+  }
+
+  return p;
+}
+
+int SaveColumns(int fd) {
+  static unsigned short* adc;
+  static unsigned char* header;
+
+  if (fd) {
+    if (m_columns == NULL) {
+      m_columns = new ColumnWriter(m_nBoards, 1024, m_chunkEvents);
+      adc = (unsigned short*)malloc(m_nBoards * 4 * 1024 * sizeof(unsigned short));
+      header = (unsigned char*)malloc(4 + m_nBoards * (4 + 4 * (4 + 1024 * 4)));
+    }
+
+    if (m_timeHeader) {
+      m_timeHeader = false;
+      int size = WriteTimeHeader(header) - header;
+      int n = m_columns->Open(fd, (unsigned short)(m_inputRange * 1000), header, size);
+      if (n < 0)
+        return -1;
+      m_fileBytes += n;
+    }
+
+    for (int b = 0; b < m_nBoards; b++)
+      for (int i = 0; i < 4; i++)
+        EncodeWaveform(b, i, adc + (b * 4 + i) * 1024);
+
+    int n = m_columns->AddEvent(m_evSerial, m_evTimeMs, m_triggerCell, adc);
+    if (n < 0)
+      return -1;
+    m_fileBytes += n;
+    m_fileEvents++;
+  }
+
+  m_evSerial++;
+
+  return 1;
+}
+
+void CloseOutput(int fd) {
+  // write out a partially filled chunk before the file goes away
+  if (m_columns)
+    m_fileBytes += m_columns->Flush();
+  close(fd);
+}
+
 int SaveWaveforms(int fd) {
   // char str[80];
   unsigned char* p;
-  unsigned short d;
-  float t;
+  unsigned short d[1024];
   int size;
-  m_nBoards = 1;
   static unsigned char* buffer;
   static int buffer_size = 0;
 
   if (fd) {
-    if (buffer_size == 0) {
-      buffer_size = 4 + m_nBoards * (4 + 4 * (4 + m_waveDepth * 4));
-      buffer_size += 24 + m_nBoards * (8 + 4 * (4 + m_waveDepth * 2));
-      buffer = (unsigned char*)malloc(buffer_size);
+    // time header and event record for every board of the chain
+    size = 4 + m_nBoards * (4 + 4 * (4 + m_waveDepth * 4));
+    size += 24 + m_nBoards * (8 + 4 * (4 + m_waveDepth * 2));
+    // zero suppressed channels carry flags, baseline and window list
+    size += m_nBoards * 4 * (6 + (m_waveDepth / 2 + 1) * 4);
+    if (size > buffer_size) {
+      buffer_size = size;
+      buffer = (unsigned char*)realloc(buffer, buffer_size);
     }
 
     p = buffer;
 
-    if (m_evSerial == 1) {
-      // time calibration header
-      memcpy(p, "TIME", 4);
-      p += 4;
-
-      for (int b = 0; b < m_nBoards; b++) {
-        // store board serial number
-        sprintf((char*)p, "B#");
-        p += 2;
-        *(unsigned short*)p = m_drs->GetBoard(b)->GetBoardSerialNumber();
-        p += sizeof(unsigned short);
-
-        for (int i = 0; i < 4; i++) {
-          // if (m_chnOn[b][i]) {
-          sprintf((char*)p, "C%03d", i + 1);
-          p += 4;
-          float tcal[2048];
-          m_drs->GetBoard(b)->GetTimeCalibration(0, i * 2, 0, tcal, 0);
-          for (int j = 0; j < m_waveDepth; j++) {
-            // save binary time as 32-bit float value
-            if (m_waveDepth == 2048) {
-              t = (tcal[j % 1024] + tcal[(j + 1) % 1024]) / 2;
-              j++;
-            } else
-              t = tcal[j];
-            *(float*)p = t;
-            p += sizeof(float);
-          }
-          //   }
-        }
-      }
+    if (m_timeHeader) {
+      m_timeHeader = false;
+      p = WriteTimeHeader(p);
     }
 
     memcpy(p, "EHDR", 4);
@@ -651,29 +1582,14 @@ int SaveWaveforms(int fd) {
 
       for (int i = 0; i < 4; i++) {
         // if (m_chnOn[b][i]) {
-        sprintf((char*)p, "C%03d", i + 1);
-        p += 4;
-        for (int j = 0; j < m_waveDepth; j++) {
-          // save binary date as 16-bit value:
-          // 0 = -0.5V,  65535 = +0.5V    for range 0
-          // 0 = -0.05V, 65535 = +0.95V   for range 0.45
-          if (m_waveDepth == 2048) {
-            // in cascaded mode, save 1024 values as averages of the 2048 values
-            d = (unsigned short)(((m_waveform[b][i][j] +
-                                   m_waveform[b][i][j + 1]) /
-				  2000.0 -
-                                  m_inputRange + 0.5) *
-                                 65535);
-            *(unsigned short*)p = d;
-            p += sizeof(unsigned short);
-            j++;
-          } else {
-            d = (unsigned short)((m_waveform[b][i][j] / 1000.0 - m_inputRange +
-                                  0.5) *
-                                 65535);
-            *(unsigned short*)p = d;
-            p += sizeof(unsigned short);
-          }
+        int n = EncodeWaveform(b, i, d);
+        if (m_zeroSuppress) {
+          p = WriteZeroSuppressed(p, b, i, d, n);
+        } else {
+          sprintf((char*)p, "C%03d", i + 1);
+          p += 4;
+          memcpy(p, d, n * sizeof(unsigned short));
+          p += n * sizeof(unsigned short);
         }
         //}
       }
@@ -684,6 +1600,8 @@ int SaveWaveforms(int fd) {
     int n = write(fd, buffer, size);
     if (n != size)
       return -1;
+    m_fileBytes += size;
+    m_fileEvents++;
   }
 
   m_evSerial++;
@@ -691,29 +1609,122 @@ int SaveWaveforms(int fd) {
   return 1;
 }
 
+int EncodeWaveform(int b, int i, unsigned short *d) {
+  int n = 0;
+
+  for (int j = 0; j < m_waveDepth; j++) {
+    // save binary date as 16-bit value:
+    // 0 = -0.5V,  65535 = +0.5V    for range 0
+    // 0 = -0.05V, 65535 = +0.95V   for range 0.45
+    if (m_waveDepth == 2048) {
+      // in cascaded mode, save 1024 values as averages of the 2048 values
+      d[n++] = (unsigned short)(((m_waveform[b][i][j] +
+                                  m_waveform[b][i][j + 1]) /
+                                 2000.0 -
+                                 m_inputRange + 0.5) *
+                                65535);
+      j++;
+    } else {
+      d[n++] = (unsigned short)((m_waveform[b][i][j] / 1000.0 - m_inputRange +
+                                 0.5) *
+                                65535);
+    }
+  }
+
+  return n;
+}
+
+unsigned char *WriteZeroSuppressed(unsigned char *p, int b, int i, unsigned short *d, int n) {
+  // Zero suppressed channel record:
+  //   "Z001"  flags (bit 0 = empty)  baseline  number of windows
+  //   per window: first sample, length, length 16-bit samples
+  // Samples outside the windows are restored as the baseline by the reader.
+  const int nBaseline = 32;
+  int threshold = (int)(m_zsThreshold / 1000.0 * 65535);
+  int baseline = 0;
+  int j;
+
+  if (m_baseline[b][i] && m_baseline[b][i]->IsValid()) {
+    // tracked baseline in the units of EncodeWaveform
+    baseline = (int)((m_baseline[b][i]->GetBaseline() / 1000.0 - m_inputRange + 0.5) * 65535);
+    baseline = baseline < 0 ? 0 : (baseline > 65535 ? 65535 : baseline);
+  } else {
+    for (j = 0; j < nBaseline && j < n; j++)
+      baseline += d[j];
+    if (j > 0)
+      baseline /= j;
+  }
+
+  sprintf((char*)p, "Z%03d", i + 1);
+  p += 4;
+  unsigned short* flags = (unsigned short*)p;
+  p += sizeof(unsigned short);
+  *(unsigned short*)p = baseline;
+  p += sizeof(unsigned short);
+  unsigned short* nWindows = (unsigned short*)p;
+  p += sizeof(unsigned short);
+
+  *nWindows = 0;
+  int start = -1;
+  int end = -1;
+  for (j = 0; j <= n; j++) {
+    if (j < n && abs(d[j] - baseline) <= threshold)
+      continue;
+
+    // extend the current window or emit it and start a new one
+    int first = j - m_zsPre < 0 ? 0 : j - m_zsPre;
+    if (start >= 0 && (j == n || first > end + 1)) {
+      *(unsigned short*)p = start;
+      p += sizeof(unsigned short);
+      *(unsigned short*)p = end - start + 1;
+      p += sizeof(unsigned short);
+      memcpy(p, d + start, (end - start + 1) * sizeof(unsigned short));
+      p += (end - start + 1) * sizeof(unsigned short);
+      (*nWindows)++;
+      start = -1;
+    }
+    if (j == n)
+      break;
+    if (start < 0)
+      start = first;
+    end = j + m_zsPost >= n ? n - 1 : j + m_zsPost;
+  }
+
+  *flags = (*nWindows == 0) ? 1 : 0;
+  return p;
+}
+
 void ReadWaveforms() {
+  TransferWaveforms();
+  CalibrateWaveforms();
+}
+
+void TransferWaveforms() {
   // unsigned char *pdata;
   // unsigned short *p;
   // int size = 0;
   // m_armed = false;
-  m_nBoards = 1;
 
-  int ofs = m_chnOffset;
   // int chip = m_chip;
 
-  if (m_drs->GetBoard(m_board)->GetBoardType() == 9) {
+  if (m_drs->GetBoard(0)->GetBoardType() == 9) {
     // DRS4 Evaluation Boards 1.1 + 3.0 + 4.0
-    // get waveforms directly from device
-    m_drs->GetBoard(m_board)->TransferWaves(m_wavebuffer[0], 0, 8);
-    m_triggerCell[0] = m_drs->GetBoard(m_board)->GetStopCell(chip);
-    m_writeSR[0] = m_drs->GetBoard(m_board)->GetStopWSR(chip);
+    // get waveforms directly from every board of the chain
+    for (int i = 0; i < m_nBoards; i++) {
+      m_drs->GetBoard(i)->TransferWaves(m_wavebuffer[i], 0, 8);
+      m_triggerCell[i] = m_drs->GetBoard(i)->GetStopCell(chip);
+      m_writeSR[i] = m_drs->GetBoard(i)->GetStopWSR(chip);
+    }
     GetTimeStamp(m_evTimestamp);
+  }
+}
+
+void CalibrateWaveforms() {
+  int ofs = m_chnOffset;
 
+  if (m_drs->GetBoard(0)->GetBoardType() == 9) {
     for (int i = 0; i < m_nBoards; i++) {
-      if (m_nBoards > 1)
-        b = m_drs->GetBoard(i);
-      else
-        b = m_drs->GetBoard(m_board);
+      b = m_drs->GetBoard(i);
 
       // obtain time arrays
       m_waveDepth = b->GetChannelDepth();
@@ -771,96 +1782,167 @@ void ReadWaveforms() {
       }
     }
   }
-}
 
-int searchWaveforms() {
-  // char str[80];
-  float waveTopPad[1024];
-  float waveBotPad[1024];
-  // float waveTopPadHold[1024];
-  // float waveBotPadHold[1024];
+  if (m_trackBaseline)
+    UpdateBaselines();
+}
 
-  for (int i = 0; i < 1024; i++) {
-    //  waveTopPadHold[i] = -1;
-    //   waveBotPadHold[i] = -1;
-    waveTopPad[i] = -1;
-    waveBotPad[i] = -1;
+bool PassesVeto() {
+  unsigned short adc[kNumberOfBins];
+  // ADC codes per mV, the cell gains are close to 1 and left out
+  const float threshold = m_vetoThreshold * 65.536;
+  const int nBaseline = m_baselineBins < 64 ? m_baselineBins : 64;
+
+  for (int i = 0; i < m_nBoards; i++) {
+    DRSBoard *board = m_drs->GetBoard(i);
+    if (board->GetChannelCascading() == 2)
+      return true; // only single channel readout is checked
+
+    int tc = m_triggerCell[i];
+    for (int w = 0; w < 4; w++) {
+      int ch = 2 * w + m_chnOffset;
+      const unsigned short *cell = board->GetCellOffset(0, ch);
+      const unsigned short *row = board->GetCellOffset2(0, ch);
+      int v[kNumberOfBins];
+
+      // offset corrected codes in readout order, the first two are noisy
+      board->DecodeWave(m_wavebuffer[i], 0, ch, adc);
+      for (int j = 0; j < kNumberOfBins; j++)
+	v[j] = adc[j] - cell[(j + tc) & (kNumberOfBins - 1)] - row[j];
+
+      float baseline = 0;
+      for (int j = 2; j < 2 + nBaseline; j++)
+	baseline += v[j];
+      baseline /= nBaseline;
+
+      int n = 0;
+      for (int j = 2; j < kNumberOfBins; j++)
+	n += baseline - v[j] > threshold;
+      if (n >= m_vetoSamples)
+	return true;
+    }
+  }
+  return false;
+}
 
+bool ReadAcceptedWaveforms() {
+  TransferWaveforms();
+  if (!m_veto) {
+    CalibrateWaveforms();
+    return true;
   }
-  
-  m_nBoards = 1;
 
-  float maxTopHeight = -1;
-  float maxBotHeight = -1;
+  unsigned long long t0 = MonotonicNs();
+  bool pass = PassesVeto();
+  unsigned long long t1 = MonotonicNs();
+  m_vetoChecked++;
+  m_vetoNs += t1 - t0;
+  if (!pass) {
+    m_vetoRejected++;
+    return false;
+  }
+  CalibrateWaveforms();
+  m_calibrateNs += MonotonicNs() - t1;
+  return true;
+}
 
-  int isMuon = -1;
-  int topk = 0;
-  int botk = 0;
-  
-  for (int j = 0; j < m_waveDepth; j++) {
-    // save binary date as 16-bit value:
-    // 0 = -0.5V,  65535 = +0.5V    for range 0
-    // 0 = -0.05V, 65535 = +0.95V   for range 0.45
+void PrintVetoStatistics() {
+  if (m_vetoChecked == 0)
+    return;
+  long accepted = m_vetoChecked - m_vetoRejected;
+  double check = m_vetoNs / 1000.0 / m_vetoChecked;
+  double calibrate = accepted ? m_calibrateNs / 1000.0 / accepted : 0;
+  printf("Veto rejected %ld of %ld events (%.1f%%), %.1f us per check, %.1f us per calibration, %.2f s CPU saved.\n",
+         m_vetoRejected, m_vetoChecked, 100.0 * m_vetoRejected / m_vetoChecked, check, calibrate,
+         (m_vetoRejected * calibrate - m_vetoChecked * check) / 1E6);
+}
 
-    if (m_waveDepth == 2048) {
+void UpdateBaselines() {
+  for (int b = 0; b < m_nBoards; b++)
+    for (int i = 0; i < 4; i++) {
+      if (!m_baseline[b][i])
+	m_baseline[b][i] = new BaselineTracker(m_baselineAlpha, m_baselinePerCell ? kNumberOfBins : 0);
+      m_baseline[b][i]->Update(m_waveform[b][i], 0, m_baselineBins, m_triggerCell[b]);
+    }
+}
 
-      //NOT ACTUALLY USED
-      // in cascaded mode, save 1024 values as averages of the 2048 values
-      waveTopPad[j/2] = (unsigned short)(((m_waveform[0][0][j] + m_waveform[0][0][j + 1]) /	2000.0 - m_inputRange + 0.5) * 65535);
-      waveBotPad[j/2] = (unsigned short)(((m_waveform[0][1][j] + m_waveform[0][1][j + 1]) /	2000.0 - m_inputRange + 0.5) * 65535);
-      j++;
-    } else {
-      //This one is used!
-      //convert negative signal to positive
+float *PulseWaveform(int b, int i) {
+  // with cell pedestals the analysis works on the corrected copy
+  return m_baselinePerCell ? m_pulseWave[b][i] : m_waveform[b][i];
+}
 
-      // waveTopPad[j] = (((m_waveform[0][0][j] / 1000.0) - m_inputRange +	0.5) *  65535)*-1;
-      // waveBotPad[j] = ((m_waveform[0][1][j] / 1000.0 - m_inputRange +	0.5) *  65535)*-1;
-     
-        waveTopPad[j] = ((m_waveform[0][0][j] ) - m_inputRange)*-1;
-        waveBotPad[j] = ((m_waveform[0][1][j] ) - m_inputRange)*-1;
+void MeasurePulse(int b, int i) {
+  const float *time = m_tcalon ? m_time[b][i] : NULL;
+  BaselineTracker *t = m_baseline[b][i];
+  float *wf = PulseWaveform(b, i);
+
+  // cell pedestals are removed from the copy, so timing and PSD see them
+  // too while the saved waveforms stay as read
+  if (m_baselinePerCell) {
+    memcpy(wf, m_waveform[b][i], m_waveDepth * sizeof(float));
+    if (t && t->IsValid())
+      for (int j = 0; j < m_waveDepth && j < kNumberOfBins; j++)
+	wf[j] -= t->GetBaseline(j, m_triggerCell[b]) - t->GetBaseline();
+  }
 
- 
-      
-      //  j++;
-    }
-    // (unsigned short)((m_waveform[b][i][j] / 1000.0 - m_inputRange +
-    //    0.5) *
-    // 65535);
+  if (!t || !t->IsValid()) {
+    FindPulse(wf, time, m_waveDepth, 0, m_baselineBins, &m_pulse[b][i]);
+    return;
   }
+  FindPulseAt(wf, time, m_waveDepth, t->GetBaseline(), t->GetRms(), &m_pulse[b][i]);
+}
 
-  for (int k = 0; k < 1024; k++)
-    {
+void searchWaveforms(count_record_t &record) {
+  // top and bottom pad on CH1 and CH2 of the first board
+  for (int i = 0; i < 2; i++) {
+    MeasurePulse(0, i);
+    record.amplitude[i] = m_pulse[0][i].amplitude;
+  }
 
-      // if (waveTopPadHold[k] == waveTopPad[k] || waveBotPadHold[k] == waveBotPad[k] ) continue;
-     
-      //Remember: signals are negative, but the above section flips them to positive values
-      //      printf("\nk is %d, ", k);
-      if (!isnan(waveTopPad[k]) && waveTopPad[k] < 10000 && waveTopPad[k] > -1) {
-	if (waveTopPad[k] > maxTopHeight) {
-	  maxTopHeight = waveTopPad[k];
-	  topk = k;
-	}
-	//	printf("top is %f ", waveTopPad[k]);
-      }
-      if (!isnan(waveBotPad[k]) && waveBotPad[k] < 10000 && waveBotPad[k] > -1) {
-	if (waveBotPad[k] > maxBotHeight) {
-	  maxBotHeight = waveBotPad[k];
-	  botk = k;
-	}
-	//	printf("bot is %f ", waveBotPad[k]);
-      }
-      //  printf("k is %d, top is %f, bot is %f\n", k, waveTopPad[k], waveBotPad[k]);
-      
-    }
- 
-  if (maxTopHeight > 20 || maxBotHeight > 20) isMuon = 1;
-  if (maxTopHeight < 20 && maxBotHeight < 20) isMuon = 0;
+  //  printf("\nPeak voltages for this event: %f mV at %d (top) and %f mV at %d (bottom).\n", m_pulse[0][0].amplitude, m_pulse[0][0].peakBin, m_pulse[0][1].amplitude, m_pulse[0][1].peakBin);
 
-  //  printf("\nPeak voltages for this event: %f mV at %d (top) and %f mV at %d (bottom). isMuon is: %d (1=muon, 0=neutron)\n", maxTopHeight, topk, maxBotHeight, botk, isMuon);
+  // constant fraction times on the calibrated time arrays, both pads at once
+  CfdTimes(PulseWaveform(0, 0), m_tcalon ? m_time[0][0] : NULL, 2048, 2, m_pulse[0], m_cfdFraction,
+           record.pulseTime);
+  for (int i = 0; i < 2; i++) {
+    if (record.pulseTime[i] >= 0 && m_pulse[0][i].amplitude > 5 * m_pulse[0][i].baselineRms)
+      record.flags |= COUNT_FLAG_TIME(i);
+    else
+      record.pulseTime[i] = 0;
+  }
+  if ((record.flags & COUNT_FLAG_TIME(0)) && (record.flags & COUNT_FLAG_TIME(1))) {
+    record.dt = record.pulseTime[1] - record.pulseTime[0];
+    record.flags |= COUNT_FLAG_DT;
+  }
 
-  // printf("Offset is %d", m_inputRange);
+  if (m_peakThreshold > 0) {
+    // every pulse on the pads, more than one is pile-up
+    for (int i = 0; i < 2; i++) {
+      int n = FindPeaks(PulseWaveform(0, i), m_tcalon ? m_time[0][i] : NULL, m_waveDepth,
+                        m_pulse[0][i].baseline, m_peakThreshold, m_peakHysteresis,
+                        m_peaks[0][i], MAX_N_PEAKS);
+      m_nPeaks[0][i] = n < MAX_N_PEAKS ? n : MAX_N_PEAKS;
+      record.nPeaks[i] = n < 255 ? n : 255;
+      if (n > 1)
+        record.flags |= COUNT_FLAG_PILEUP;
+    }
+    if (record.flags & COUNT_FLAG_PILEUP)
+      m_pileupEvents++;
+  }
 
-  return isMuon;
+  // piled-up pulses have no meaningful shape
+  if (m_psd && !(m_rejectPileup && (record.flags & COUNT_FLAG_PILEUP))) {
+    // shape of the larger of the two pulses, slow tails are neutrons
+    int i = m_pulse[0][1].amplitude > m_pulse[0][0].amplitude;
+    if (m_pulse[0][i].amplitude > 5 * m_pulse[0][i].baselineRms) {
+      ComputePsd(PulseWaveform(0, i), m_tcalon ? m_time[0][i] : NULL, m_waveDepth, &m_pulse[0][i],
+                 m_cfdFraction, m_psdPre, m_psdPrompt, m_psdTotal, 1.0 / m_drs->GetBoard(0)->GetNominalFrequency(), &m_psdResult);
+      if (m_psdResult.total > 0) {
+        record.psd = m_psdResult.psd;
+        record.flags |= COUNT_FLAG_PSD;
+      }
+    }
+  }
 }
 
 void GetTimeStamp(TIMESTAMP& ts) {
@@ -872,6 +1954,7 @@ void GetTimeStamp(TIMESTAMP& ts) {
   gettimeofday(&t, NULL);
   time(&now);
   lt = localtime(&now);
+  m_evTimeMs = (long long)t.tv_sec * 1000 + t.tv_usec / 1000;
 
   ts.Year = lt->tm_year + 1900;
   ts.Month = lt->tm_mon + 1;
@@ -897,6 +1980,35 @@ double GetSamplingSpeed() {
   return m_samplingSpeed;
 }
 
+bool StopRequested() {
+  static unsigned long long nextPoll = 0;
+
+  if (killSignalFlag || m_stopRun)
+    return true;
+  // look for "stop" every 10 ms, other commands wait for the run to end
+  if (m_control.IsOpen() && MonotonicNs() >= nextPoll) {
+    nextPoll = MonotonicNs() + 10000000ULL;
+    m_control.Read(0);
+    if (m_control.Find("stop", true) || m_control.Find("quit"))
+      m_stopRun = 1;
+  }
+  return m_stopRun;
+}
+
+void ResetRunState() {
+  // a daemon runs many times on the same boards, the counters start over
+  for (int i = 0; i < m_nHist; i++)
+    delete m_hist[i];
+  m_nHist = 0;
+  m_evSerial = 1;
+  m_filePart = 0;
+  m_pileupEvents = 0;
+  m_vetoChecked = m_vetoRejected = 0;
+  m_vetoNs = m_calibrateNs = 0;
+  m_prescaler.ResetCounts();
+  m_stopRun = 0;
+}
+
 void exitGracefully(int sig) {
   killSignalFlag = 1;
 }
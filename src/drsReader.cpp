@@ -0,0 +1,225 @@
+/********************************************************************\
+
+Name:         drsReader.cpp
+
+Contents:     Reader for the binary event files written by drsLog
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "drsReader.h"
+
+/*------------------------------------------------------------------*/
+
+DRSReader::DRSReader() {
+  fFile = NULL;
+  fNBoards = 0;
+  memset(fHasTime, 0, sizeof(fHasTime));
+  memset(&fHeader, 0, sizeof(fHeader));
+}
+
+DRSReader::~DRSReader() {
+  Close();
+}
+
+bool DRSReader::Open(const char *filename) {
+  Close();
+  fFile = fopen(filename, "rb");
+  return fFile != NULL;
+}
+
+void DRSReader::Close() {
+  if (fFile)
+    fclose(fFile);
+  fFile = NULL;
+}
+
+/*------------------------------------------------------------------*/
+
+bool DRSReader::Peek(char *tag, int n) {
+  if ((int)fread(tag, 1, n, fFile) != n)
+    return false;
+  fseek(fFile, -n, SEEK_CUR);
+  return true;
+}
+
+bool DRSReader::ReadTimeHeader() {
+  char tag[4];
+  unsigned short serial;
+
+  // "TIME" followed by "B#" serial and four "C00x" blocks of float bin widths
+  for (int b = 0; b < READER_MAX_BOARDS; b++) {
+    if (!Peek(tag, 2) || memcmp(tag, "B#", 2) != 0)
+      return b > 0;
+    fread(tag, 1, 2, fFile);
+    if (fread(&serial, sizeof(serial), 1, fFile) != 1)
+      return false;
+    fTimeSerial[b] = serial;
+    for (int i = 0; i < READER_N_CHANNELS; i++) {
+      if (fread(tag, 1, 4, fFile) != 4 || tag[0] != 'C')
+        return false;
+      if (fread(fTcal[b][i], sizeof(float), READER_N_BINS, fFile) != READER_N_BINS)
+        return false;
+    }
+    fHasTime[b] = true;
+  }
+  return true;
+}
+
+bool DRSReader::ReadChannel(channel_record_t *c, bool suppressed) {
+  unsigned short w[3];
+
+  c->present = true;
+  c->suppressed = suppressed;
+  if (!suppressed) {
+    c->empty = false;
+    c->baseline = 0;
+    c->nWindows = 1;
+    c->winStart[0] = 0;
+    c->winLength[0] = READER_N_BINS;
+    return fread(c->data, sizeof(unsigned short), READER_N_BINS, fFile) == READER_N_BINS;
+  }
+
+  // flags, baseline, number of windows
+  if (fread(w, sizeof(unsigned short), 3, fFile) != 3)
+    return false;
+  c->empty = (w[0] & 1) != 0;
+  c->baseline = w[1];
+  c->nWindows = w[2];
+  if (c->nWindows > READER_N_BINS / 2 + 1)
+    return false;
+
+  int n = 0;
+  for (int k = 0; k < c->nWindows; k++) {
+    unsigned short h[2];
+    if (fread(h, sizeof(unsigned short), 2, fFile) != 2)
+      return false;
+    if (h[0] + h[1] > READER_N_BINS || n + h[1] > READER_N_BINS)
+      return false;
+    c->winStart[k] = h[0];
+    c->winLength[k] = h[1];
+    if (fread(c->data + n, sizeof(unsigned short), h[1], fFile) != h[1])
+      return false;
+    n += h[1];
+  }
+  return true;
+}
+
+int DRSReader::ReadEvent() {
+  char tag[4];
+
+  if (!fFile)
+    return -1;
+
+  if (fread(tag, 1, 4, fFile) != 4)
+    return 0;
+
+  // a time calibration header precedes the first event of every file
+  if (memcmp(tag, "TIME", 4) == 0) {
+    if (!ReadTimeHeader())
+      return -1;
+    if (fread(tag, 1, 4, fFile) != 4)
+      return 0;
+  }
+
+  if (memcmp(tag, "EHDR", 4) != 0)
+    return -1;
+
+  unsigned short ts[8];
+  if (fread(&fHeader.serial, sizeof(int), 1, fFile) != 1 ||
+      fread(ts, sizeof(unsigned short), 8, fFile) != 8)
+    return -1;
+  fHeader.year = ts[0];
+  fHeader.month = ts[1];
+  fHeader.day = ts[2];
+  fHeader.hour = ts[3];
+  fHeader.minute = ts[4];
+  fHeader.second = ts[5];
+  fHeader.millisecond = ts[6];
+  fHeader.range = ts[7];
+
+  fNBoards = 0;
+  while (fNBoards < READER_MAX_BOARDS && Peek(tag, 2) && memcmp(tag, "B#", 2) == 0) {
+    int b = fNBoards;
+    unsigned short s[2];
+
+    fread(tag, 1, 2, fFile);
+    if (fread(&s[0], sizeof(unsigned short), 1, fFile) != 1)
+      return -1;
+    if (fread(tag, 1, 2, fFile) != 2 || memcmp(tag, "T#", 2) != 0)
+      return -1;
+    if (fread(&s[1], sizeof(unsigned short), 1, fFile) != 1)
+      return -1;
+    fSerial[b] = s[0];
+    fTriggerCell[b] = s[1];
+
+    for (int i = 0; i < READER_N_CHANNELS; i++)
+      fChannel[b][i].present = false;
+
+    while (Peek(tag, 4) && (tag[0] == 'C' || tag[0] == 'Z') &&
+           tag[1] == '0' && tag[2] == '0' && tag[3] >= '1' && tag[3] <= '4') {
+      fread(tag, 1, 4, fFile);
+      if (!ReadChannel(&fChannel[b][tag[3] - '1'], tag[0] == 'Z'))
+        return -1;
+    }
+    fNBoards++;
+  }
+
+  return fNBoards > 0 ? 1 : -1;
+}
+
+/*------------------------------------------------------------------*/
+
+int DRSReader::GetStoredSamples(int b, int ch) const {
+  const channel_record_t *c = &fChannel[b][ch];
+  int n = 0;
+
+  if (!c->present)
+    return 0;
+  for (int k = 0; k < c->nWindows; k++)
+    n += c->winLength[k];
+  return n;
+}
+
+int DRSReader::GetWaveform(int b, int ch, unsigned short *adc) const {
+  const channel_record_t *c = &fChannel[b][ch];
+
+  if (b >= fNBoards || !c->present)
+    return 0;
+
+  if (c->suppressed) {
+    for (int j = 0; j < READER_N_BINS; j++)
+      adc[j] = c->baseline;
+  }
+
+  int n = 0;
+  for (int k = 0; k < c->nWindows; k++) {
+    memcpy(adc + c->winStart[k], c->data + n, c->winLength[k] * sizeof(unsigned short));
+    n += c->winLength[k];
+  }
+  return READER_N_BINS;
+}
+
+int DRSReader::GetWaveform(int b, int ch, float *mV) const {
+  unsigned short adc[READER_N_BINS];
+
+  if (!GetWaveform(b, ch, adc))
+    return 0;
+
+  // inverse of the 16-bit encoding in SaveWaveforms()
+  for (int j = 0; j < READER_N_BINS; j++)
+    mV[j] = (adc[j] / 65535.0 - 0.5) * 1000.0 + fHeader.range;
+  return READER_N_BINS;
+}
+
+int DRSReader::GetTimeCalibration(int b, int ch, float *tcal) const {
+  for (int i = 0; i < READER_MAX_BOARDS; i++) {
+    if (fHasTime[i] && fTimeSerial[i] == fSerial[b]) {
+      memcpy(tcal, fTcal[i][ch], sizeof(fTcal[i][ch]));
+      return READER_N_BINS;
+    }
+  }
+  return 0;
+}
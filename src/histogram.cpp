@@ -0,0 +1,104 @@
+/********************************************************************\
+
+Name:         histogram.cpp
+
+Contents:     Online histograms, see histogram.h
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "histogram.h"
+#include "strlcpy.h"
+
+/*------------------------------------------------------------------*/
+
+Histogram::Histogram(const char *name, int nx, float xmin, float xmax, int nShards) {
+  Init(name, nx, xmin, xmax, 0, 0, 0, nShards);
+}
+
+Histogram::Histogram(const char *name, int nx, float xmin, float xmax, int ny, float ymin,
+                     float ymax, int nShards) {
+  Init(name, nx, xmin, xmax, ny, ymin, ymax, nShards);
+}
+
+void Histogram::Init(const char *name, int nx, float xmin, float xmax, int ny, float ymin,
+                     float ymax, int nShards) {
+  strlcpy(fName, name, sizeof(fName));
+  fNx = nx;
+  fNy = ny;
+  fXmin = xmin;
+  fXmax = xmax;
+  fYmin = ymin;
+  fYmax = ymax;
+  fXscale = nx / (xmax - xmin);
+  fYscale = ny > 0 ? ny / (ymax - ymin) : 0;
+  fNShards = nShards;
+  fSize = (nx + 2) * (ny > 0 ? ny + 2 : 1);
+  fBins = (unsigned int *)calloc((size_t)fSize * nShards, sizeof(unsigned int));
+  assert(fBins);
+}
+
+Histogram::~Histogram() {
+  free(fBins);
+}
+
+/*------------------------------------------------------------------*/
+
+void Histogram::Snapshot(unsigned int *sum) const {
+  memset(sum, 0, fSize * sizeof(unsigned int));
+  for (int s = 0; s < fNShards; s++) {
+    const unsigned int *b = fBins + s * fSize;
+    for (int i = 0; i < fSize; i++)
+      sum[i] += __atomic_load_n(b + i, __ATOMIC_RELAXED);
+  }
+}
+
+void Histogram::Write(FILE *f) const {
+  unsigned int *sum = (unsigned int *)malloc(fSize * sizeof(unsigned int));
+  unsigned long under = 0, over = 0;
+
+  Snapshot(sum);
+  if (fNy == 0) {
+    fprintf(f, "# %s %d %g %g\n", fName, fNx, fXmin, fXmax);
+    for (int i = 1; i <= fNx; i++)
+      fprintf(f, "%g %u\n", fXmin + (i - 0.5) / fXscale, sum[i]);
+    under = sum[0];
+    over = sum[fNx + 1];
+  } else {
+    fprintf(f, "# %s %d %g %g %d %g %g\n", fName, fNx, fXmin, fXmax, fNy, fYmin, fYmax);
+    for (int j = 0; j < fNy + 2; j++)
+      for (int i = 0; i < fNx + 2; i++) {
+        unsigned int n = sum[j * (fNx + 2) + i];
+        if (i == 0 || j == 0)
+          under += n;
+        else if (i == fNx + 1 || j == fNy + 1)
+          over += n;
+        else
+          fprintf(f, "%g %g %u\n", fXmin + (i - 0.5) / fXscale, fYmin + (j - 0.5) / fYscale, n);
+      }
+  }
+  fprintf(f, "# underflow %lu overflow %lu\n\n\n", under, over);
+  free(sum);
+}
+
+/*------------------------------------------------------------------*/
+
+bool WriteHistograms(const char *filename, Histogram **h, int n) {
+  char tmp[1024];
+
+  strlcpy(tmp, filename, sizeof(tmp));
+  strlcat(tmp, ".tmp", sizeof(tmp));
+  FILE *f = fopen(tmp, "w");
+  if (!f)
+    return false;
+  for (int i = 0; i < n; i++)
+    h[i]->Write(f);
+  if (fclose(f) != 0)
+    return false;
+  // readers never see a half written file
+  return rename(tmp, filename) == 0;
+}
@@ -0,0 +1,78 @@
+/********************************************************************\
+
+Name:         liveTime.cpp
+
+Contents:     Live time accounting, see liveTime.h
+
+\********************************************************************/
+
+#include <string.h>
+
+#include "liveTime.h"
+
+/*------------------------------------------------------------------*/
+
+LiveTimeMeter::LiveTimeMeter(double seconds) {
+  SetInterval(seconds);
+  Start(0);
+}
+
+void LiveTimeMeter::Reset(live_interval_t &i, unsigned long long t) {
+  memset(&i, 0, sizeof(i));
+  i.start = i.end = t;
+}
+
+void LiveTimeMeter::Start(unsigned long long t) {
+  fMark = t;
+  fArmed = false;
+  Reset(fCurrent, t);
+  Reset(fTotal, t);
+}
+
+void LiveTimeMeter::Arm(unsigned long long t) {
+  if (!fArmed)
+    fCurrent.dead += t - fMark;
+  else
+    fCurrent.live += t - fMark; // re-armed without a trigger
+  fMark = t;
+  fArmed = true;
+}
+
+void LiveTimeMeter::Trigger(unsigned long long t, bool event) {
+  if (fArmed)
+    fCurrent.live += t - fMark;
+  fMark = t;
+  fArmed = false;
+  if (event)
+    fCurrent.events++;
+}
+
+/*------------------------------------------------------------------*/
+
+live_interval_t LiveTimeMeter::Close(unsigned long long t) {
+  // split the running period at t
+  if (fArmed)
+    fCurrent.live += t - fMark;
+  else
+    fCurrent.dead += t - fMark;
+  fMark = t;
+  fCurrent.end = t;
+
+  live_interval_t closed = fCurrent;
+  fTotal.events += closed.events;
+  fTotal.live += closed.live;
+  fTotal.dead += closed.dead;
+  fTotal.end = t;
+  Reset(fCurrent, t);
+  return closed;
+}
+
+live_interval_t LiveTimeMeter::GetTotal(unsigned long long t) const {
+  live_interval_t total = fTotal;
+
+  total.events += fCurrent.events;
+  total.live += fCurrent.live + (fArmed ? t - fMark : 0);
+  total.dead += fCurrent.dead + (fArmed ? 0 : t - fMark);
+  total.end = t;
+  return total;
+}
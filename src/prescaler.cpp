@@ -0,0 +1,103 @@
+/********************************************************************\
+
+Name:         prescaler.cpp
+
+Contents:     Waveform prescaler, see prescaler.h
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prescaler.h"
+
+/*------------------------------------------------------------------*/
+
+Prescaler::Prescaler() {
+  SetAll(0);
+  ResetCounts();
+  fRandom = false;
+  fState = 2463534242U;
+}
+
+void Prescaler::SetAll(int factor) {
+  for (int c = 0; c <= N_CLASSES; c++)
+    fFactor[c] = factor;
+}
+
+void Prescaler::ResetCounts() {
+  memset(fCount, 0, sizeof(fCount));
+  memset(fSaved, 0, sizeof(fSaved));
+}
+
+bool Prescaler::Parse(const char *spec) {
+  char buffer[256];
+  char *save;
+
+  strncpy(buffer, spec, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = 0;
+  for (char *s = strtok_r(buffer, ",", &save); s; s = strtok_r(NULL, ",", &save)) {
+    char *value = strchr(s, '=');
+    char *end;
+    if (!value) {
+      // a bare factor applies to every class
+      int n = strtol(s, &end, 10);
+      if (*end || n < 0)
+        return false;
+      SetAll(n);
+      continue;
+    }
+    *value++ = 0;
+    int n = strtol(value, &end, 10);
+    if (*end || n < 0)
+      return false;
+    int c;
+    for (c = 0; c < N_CLASSES; c++)
+      if (strcmp(s, className[c]) == 0)
+        break;
+    if (c < N_CLASSES)
+      SetFactor(c, n);
+    else if (strcmp(s, "unclassified") == 0)
+      SetFactor(CLASS_NONE, n);
+    else
+      return false;
+  }
+  return true;
+}
+
+bool Prescaler::IsActive() const {
+  for (int c = 0; c <= N_CLASSES; c++)
+    if (fFactor[c])
+      return true;
+  return false;
+}
+
+/*------------------------------------------------------------------*/
+
+bool Prescaler::Accept(int c) {
+  int factor = fFactor[c + 1];
+  long n = fCount[c + 1]++;
+
+  if (factor <= 0)
+    return false;
+  if (fRandom) {
+    // xorshift32, cheap and good enough to break up periodic patterns
+    fState ^= fState << 13;
+    fState ^= fState >> 17;
+    fState ^= fState << 5;
+    if (fState % factor)
+      return false;
+  } else if (n % factor) {
+    return false;
+  }
+  fSaved[c + 1]++;
+  return true;
+}
+
+void Prescaler::Print() const {
+  printf("Waveforms saved:");
+  for (int c = 0; c < N_CLASSES; c++)
+    printf(" %ld of %ld %s,", fSaved[c + 1], fCount[c + 1], className[c]);
+  printf(" %ld of %ld unclassified\n", fSaved[0], fCount[0]);
+}
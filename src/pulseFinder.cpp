@@ -0,0 +1,263 @@
+/********************************************************************\
+
+Name:         pulseFinder.cpp
+
+Contents:     Peak search on calibrated waveforms, see pulseFinder.h
+
+\********************************************************************/
+
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pulseFinder.h"
+
+/*------------------------------------------------------------------*/
+
+int FindMinimum(const float *wf, int n, float *min) {
+  int i = 0;
+  int k = 0;
+  float m = wf[0];
+
+#ifdef __SSE2__
+  if (n >= 8) {
+    // four running minima with the bin they were found in
+    __m128 vmin = _mm_loadu_ps(wf);
+    __m128i vidx = _mm_set_epi32(3, 2, 1, 0);
+    __m128i idx = vidx;
+    const __m128i four = _mm_set1_epi32(4);
+
+    for (i = 4; i + 4 <= n; i += 4) {
+      __m128 v = _mm_loadu_ps(wf + i);
+      idx = _mm_add_epi32(idx, four);
+      __m128i lt = _mm_castps_si128(_mm_cmplt_ps(v, vmin));
+      vmin = _mm_min_ps(v, vmin);
+      vidx = _mm_or_si128(_mm_and_si128(lt, idx), _mm_andnot_si128(lt, vidx));
+    }
+
+    float lane[4];
+    int laneIdx[4];
+    _mm_storeu_ps(lane, vmin);
+    _mm_storeu_si128((__m128i *)laneIdx, vidx);
+    m = lane[0];
+    k = laneIdx[0];
+    for (int j = 1; j < 4; j++)
+      if (lane[j] < m || (lane[j] == m && laneIdx[j] < k)) {
+        m = lane[j];
+        k = laneIdx[j];
+      }
+  }
+#endif
+
+  for (; i < n; i++)
+    if (wf[i] < m) {
+      m = wf[i];
+      k = i;
+    }
+
+  *min = m;
+  return k;
+}
+
+/*------------------------------------------------------------------*/
+
+void FindPulse(const float *wf, const float *time, int n, int first, int nBins, pulse_t *p) {
+  double sum = 0, sum2 = 0;
+  int count = 0;
+
+  if (first + nBins > n)
+    nBins = n - first;
+
+  for (int i = first; i < first + nBins; i++) {
+    sum += wf[i];
+    sum2 += wf[i] * wf[i];
+  }
+  double mean = nBins > 0 ? sum / nBins : 0;
+  double rms = nBins > 1 ? sqrt(fabs(sum2 / nBins - mean * mean)) : 0;
+
+  // second pass without spikes and pulse tails beyond 3 sigma
+  if (rms > 0) {
+    double lo = mean - 3 * rms, hi = mean + 3 * rms;
+    sum = sum2 = 0;
+    for (int i = first; i < first + nBins; i++)
+      if (wf[i] >= lo && wf[i] <= hi) {
+        sum += wf[i];
+        sum2 += wf[i] * wf[i];
+        count++;
+      }
+    if (count > 1) {
+      mean = sum / count;
+      rms = sqrt(fabs(sum2 / count - mean * mean));
+    }
+  }
+
+  FindPulseAt(wf, time, n, mean, rms, p);
+}
+
+void FindPulseAt(const float *wf, const float *time, int n, float baseline, float rms, pulse_t *p) {
+  float min;
+
+  p->baseline = baseline;
+  p->baselineRms = rms;
+  p->peakBin = FindMinimum(wf, n, &min);
+  p->amplitude = baseline - min;
+  p->peakTime = time ? time[p->peakBin] : p->peakBin;
+}
+
+/*------------------------------------------------------------------*/
+
+float FindLeadingEdge(const float *wf, const pulse_t *p, float fraction) {
+  float level = p->baseline - fraction * p->amplitude;
+
+  // walk back from the peak to the first sample above the level
+  for (int i = p->peakBin; i > 0; i--)
+    if (wf[i - 1] > level && wf[i] <= level)
+      return i - 1 + (wf[i - 1] - level) / (wf[i - 1] - wf[i]);
+  return -1;
+}
+
+/*------------------------------------------------------------------*/
+
+float CfdTime(const float *wf, const float *time, const pulse_t *p, float fraction) {
+  float f = FindLeadingEdge(wf, p, fraction);
+
+  if (f < 0 || !time)
+    return f;
+
+  // bins are not equally wide, interpolate between their calibrated times
+  int i = (int)f;
+  return time[i] + (f - i) * (time[i + 1] - time[i]);
+}
+
+void CfdTimes(const float *wf, const float *time, int stride, int nChannels, const pulse_t *p,
+              float fraction, float *t) {
+  for (int i = 0; i < nChannels; i++)
+    t[i] = CfdTime(wf + i * stride, time ? time + i * stride : NULL, p + i, fraction);
+}
+
+/*------------------------------------------------------------------*/
+
+void PrefixSum(const float *wf, int n, float baseline, float *sum) {
+  int i = 0;
+
+  sum[0] = 0;
+#ifdef __SSE2__
+  // in-register scan of four samples, carried from block to block
+  __m128 base = _mm_set1_ps(baseline);
+  __m128 carry = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_sub_ps(base, _mm_loadu_ps(wf + i));
+    x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+    x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+    x = _mm_add_ps(x, carry);
+    _mm_storeu_ps(sum + i + 1, x);
+    carry = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+#endif
+  for (; i < n; i++)
+    sum[i + 1] = sum[i] + (baseline - wf[i]);
+}
+
+/*------------------------------------------------------------------*/
+
+static int ClampBin(float bin, int n) {
+  int b = (int)floorf(bin + 0.5f);
+  return b < 0 ? 0 : (b > n ? n : b);
+}
+
+void ComputePsd(const float *wf, const float *time, int n, const pulse_t *p, float fraction,
+                float pre, float prompt, float total, float binWidth, psd_t *psd) {
+  float sum[2049];
+
+  psd->start = FindLeadingEdge(wf, p, fraction);
+  psd->prompt = psd->total = psd->psd = 0;
+  if (psd->start < 0 || n > 2048)
+    return;
+
+  if (time && n > 1)
+    binWidth = (time[n - 1] - time[0]) / (n - 1);
+  PrefixSum(wf, n, p->baseline, sum);
+
+  int a = ClampBin(psd->start - pre / binWidth, n);
+  int b = ClampBin(psd->start + prompt / binWidth, n);
+  int c = ClampBin(psd->start + total / binWidth, n);
+
+  psd->prompt = (sum[b] - sum[a]) * binWidth;
+  psd->total = (sum[c] - sum[a]) * binWidth;
+  if (psd->total > 0)
+    psd->psd = (psd->total - psd->prompt) / psd->total;
+}
+
+/*------------------------------------------------------------------*/
+
+int FindPeaks(const float *wf, const float *time, int n, float baseline, float threshold,
+              float hysteresis, peak_t *peak, int maxPeaks) {
+  int nPeaks = 0;
+  int state = 0;                // 0 quiet, 1 rising into a peak, 2 after a peak
+  float extreme = 0;
+  int at = 0;
+  float level = baseline - threshold;
+
+  for (int j = 0; j < n; j++) {
+#ifdef __SSE2__
+    // skip quiet stretches four samples at a time
+    if (state == 0) {
+      __m128 l = _mm_set1_ps(level);
+      while (j + 4 <= n && _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(wf + j), l)) == 0)
+        j += 4;
+      if (j == n)
+        break;
+    }
+#endif
+    float d = baseline - wf[j];
+
+    switch (state) {
+    case 0:
+      if (d > threshold) {
+        state = 1;
+        extreme = d;
+        at = j;
+      }
+      break;
+    case 1:
+      if (d > extreme) {
+        extreme = d;
+        at = j;
+      } else if (d < extreme - hysteresis) {
+        if (nPeaks < maxPeaks) {
+          peak[nPeaks].amplitude = extreme;
+          peak[nPeaks].bin = at;
+          peak[nPeaks].time = time ? time[at] : at;
+        }
+        nPeaks++;
+        state = 2;
+        extreme = d;
+      }
+      break;
+    case 2:
+      if (d < threshold - hysteresis) {
+        state = 0;
+      } else if (d < extreme) {
+        extreme = d;
+      } else if (d > extreme + hysteresis && d > threshold) {
+        state = 1;
+        extreme = d;
+        at = j;
+      }
+      break;
+    }
+  }
+
+  // a pulse still rising at the end of the window
+  if (state == 1) {
+    if (nPeaks < maxPeaks) {
+      peak[nPeaks].amplitude = extreme;
+      peak[nPeaks].bin = at;
+      peak[nPeaks].time = time ? time[at] : at;
+    }
+    nPeaks++;
+  }
+  return nPeaks;
+}